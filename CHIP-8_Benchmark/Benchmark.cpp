@@ -0,0 +1,497 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BatchRunner.h"
+#include "Cpu.h"
+#include "Headless.h"
+#include "Log.h"
+#include "PixelConverter.h"
+#include "Upscaler.h"
+
+#define DEFAULT_MIN_TIME   0.5								// seconds every benchmark runs at least
+#define MAX_ITERATIONS     1000000000ull
+#define MACRO_CYCLES       1000000							// cycles per iteration of ROM benchmarks
+#define BENCHMARK_SEED     1
+#define CODE_START         ROM_START						// micro benchmarks execute instruction placed here
+#define DATA_START         0x300							// and point I here
+
+/* Keeps value alive, so compiler can't drop computation of it. */
+template <typename T>
+static void DoNotOptimize(const T& value)
+{
+	volatile T sink = value;
+	(void)sink;
+}
+
+/* Passed to benchmark function. Function runs its measured code once per KeepRunning() call
+ * and reports how many items (instructions, pixels...) one iteration processes. Only the loop
+ * is timed, from the first KeepRunning() call to the one which returns false, so setup before
+ * it and cleanup after it don't count. */
+class BenchmarkState
+{
+public:
+	explicit BenchmarkState(unsigned long long iterations) : iterations(iterations), remaining(iterations), itemsPerIteration(0),
+		started(false), realSeconds(0.0), cpuSeconds(0.0) {}
+
+	bool KeepRunning()
+	{
+		if (!started)
+		{
+			started = true;
+			cpuStart = std::clock();
+			realStart = std::chrono::steady_clock::now();
+		}
+
+		if (remaining == 0)
+		{
+			realSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+			cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+			return false;
+		}
+
+		--remaining;
+		return true;
+	}
+
+	void SetItemsPerIteration(unsigned long long items)
+	{
+		itemsPerIteration = items;
+	}
+
+	unsigned long long Iterations() const
+	{
+		return iterations;
+	}
+
+	unsigned long long ItemsPerIteration() const
+	{
+		return itemsPerIteration;
+	}
+
+	double RealSeconds() const
+	{
+		return realSeconds;
+	}
+
+	double CPUSeconds() const
+	{
+		return cpuSeconds;
+	}
+
+private:
+	unsigned long long iterations;
+	unsigned long long remaining;
+	unsigned long long itemsPerIteration;
+	bool started;
+	std::clock_t cpuStart;
+	std::chrono::steady_clock::time_point realStart;
+	double realSeconds;										// 0 until loop ends
+	double cpuSeconds;
+};
+
+struct Benchmark
+{
+	std::string name;
+	std::function<void(BenchmarkState&)> run;
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	unsigned long long iterations;
+	double realTime;										// ns per iteration
+	double cpuTime;											// ns per iteration
+	double itemsPerSecond;									// 0 if benchmark doesn't count items
+};
+
+/* Gives benchmarks access to Chip8 internals, same way generated translations get it. */
+struct Chip8Benchmark
+{
+	/* Chip8 with single opcode at CODE_START, registers set so any opcode can run. */
+	static std::unique_ptr<Chip8> MakeChip(Chip8::InterpreterEngine engine, unsigned short opcode)
+	{
+		std::unique_ptr<Chip8> chip(new Chip8());
+		chip->SetRandomSeed(BENCHMARK_SEED);
+		chip->SetEngine(engine);
+
+		for (int i = 0; i < 16; ++i)
+			chip->memory[DATA_START + i] = 0xA5 ^ (unsigned char)(i * 0x11);
+
+		chip->memory[CODE_START]     = opcode >> 8;
+		chip->memory[CODE_START + 1] = opcode & 0xFF;
+		chip->V[0] = 10;
+		chip->V[1] = 8;
+		ResetFlow(*chip);
+		return chip;
+	}
+
+	/* Puts pc, I and stack back, so the same instruction runs every iteration. */
+	static void ResetFlow(Chip8& chip)
+	{
+		chip.pc = CODE_START;
+		chip.I  = DATA_START;
+		chip.sp = 1;
+		chip.stack[0] = CODE_START;
+	}
+
+	static void Opcode(BenchmarkState& state, Chip8::InterpreterEngine engine, unsigned short opcode)
+	{
+		std::unique_ptr<Chip8> chip = MakeChip(engine, opcode);
+
+		while (state.KeepRunning())
+		{
+			ResetFlow(*chip);
+			chip->DecodeExecute();
+		}
+
+		DoNotOptimize(chip->V[0]);
+		state.SetItemsPerIteration(1);
+	}
+
+	static void Sprite(BenchmarkState& state, unsigned char x, unsigned char height)
+	{
+		std::unique_ptr<Chip8> chip = MakeChip(Chip8::ENGINE_DECODE_CACHE, 0xD010 | height);
+		chip->V[0] = x;
+
+		while (state.KeepRunning())
+		{
+			ResetFlow(*chip);
+			chip->DecodeExecute();
+		}
+
+		DoNotOptimize(chip->gfx[8]);
+		state.SetItemsPerIteration(height);
+	}
+
+	/* Screen image as window shows it, scaled with default options. */
+	static void ScreenImage(BenchmarkState& state)
+	{
+		std::unique_ptr<Chip8> chip(new Chip8());
+		chip->upscaler.reset(new Upscaler(chip->scaleOptions));	// MainLoop creates it with window
+
+		ScreenFrame frame;
+		for (int y = 0; y < SCREEN_HEIGHT; ++y)
+			frame.gfx[y] = 0x9E3779B97F4A7C15ull * (y + 1);
+
+		while (state.KeepRunning())
+			chip->UpdateScreenImage(frame);
+
+		DoNotOptimize(chip->upscaler->Pixels()[NUM_PIXELS * 2]);
+		state.SetItemsPerIteration(chip->upscaler->Width() * chip->upscaler->Height());
+	}
+};
+
+/* Scaling of whole screen with given options, items are output pixels. */
+static void ScaleScreen(BenchmarkState& state, const ScaleOptions& options)
+{
+	uint64_t rows[SCREEN_HEIGHT];
+	for (int y = 0; y < SCREEN_HEIGHT; ++y)
+		rows[y] = 0x9E3779B97F4A7C15ull * (y + 1);
+
+	Upscaler upscaler(options);
+	Palette palette = DefaultPalette();
+
+	while (state.KeepRunning())
+		upscaler.Scale(rows, ALL_ROWS, palette);
+
+	DoNotOptimize(upscaler.Pixels()[NUM_PIXELS * 2]);
+	state.SetItemsPerIteration(upscaler.Width() * upscaler.Height());
+}
+
+/* Conversion of whole screen to RGBA at 1:1 with given converter, so vector version used by
+ * Upscaler and reference scalar one run the same workload. */
+static void ConvertScreen(BenchmarkState& state, void (*convert)(const uint64_t*, unsigned int, const Palette&, unsigned char*))
+{
+	uint64_t rows[SCREEN_HEIGHT];
+	for (int y = 0; y < SCREEN_HEIGHT; ++y)
+		rows[y] = 0x9E3779B97F4A7C15ull * (y + 1);
+
+	std::vector<unsigned char> rgba(NUM_PIXELS * 4);
+	Palette palette = DefaultPalette();
+
+	while (state.KeepRunning())
+		convert(rows, SCREEN_HEIGHT, palette, rgba.data());
+
+	DoNotOptimize(rgba[NUM_PIXELS * 2]);
+	state.SetItemsPerIteration(NUM_PIXELS);
+}
+
+/* Whole ROM run headless for MACRO_CYCLES from the same starting state every iteration. Chip is
+ * built and ROM loaded once, iterations only restore snapshot taken after loading. Items are
+ * instructions actually executed, cycles elided by idle loop skipping don't count. */
+static void RunROM(BenchmarkState& state, const std::string& romPath, Chip8::InterpreterEngine engine)
+{
+	HeadlessOptions options;
+	options.frames = 0;
+	options.maxCycles = MACRO_CYCLES;
+
+	std::unique_ptr<Chip8> chip(new Chip8());
+	if (!chip->LoadROM(romPath))
+		return;
+
+	chip->SetEngine(engine);
+	chip->SetRandomSeed(BENCHMARK_SEED);
+
+	std::unique_ptr<MachineState> start(new MachineState());
+	chip->Snapshot(*start);
+
+	unsigned int hash = 0;
+	unsigned long long executed = 0;
+	while (state.KeepRunning())
+	{
+		chip->Restore(*start);
+		HeadlessResult result = RunHeadless(*chip, options);
+		hash ^= result.framebufferHash;
+		executed = result.cycles - result.idleCycles;		// the same every iteration
+	}
+
+	DoNotOptimize(hash);
+	state.SetItemsPerIteration(executed);
+}
+
+static std::vector<Benchmark> RegisterBenchmarks(const std::string& romDirectory)
+{
+	struct EngineName { Chip8::InterpreterEngine engine; const char* name; };
+	const EngineName engines[] = {
+		{ Chip8::ENGINE_DECODE_CACHE,   "cache" },
+		{ Chip8::ENGINE_DISPATCH_TABLE, "table" },
+		{ Chip8::ENGINE_BLOCK_CACHE,    "block" },
+		{ Chip8::ENGINE_JIT,            "jit" }
+	};
+
+	struct OpcodeName { unsigned short opcode; const char* name; };
+	const OpcodeName opcodes[] = {
+		{ 0x00E0, "00E0" }, { 0x00EE, "00EE" }, { 0x1200, "1NNN" }, { 0x2200, "2NNN" }, { 0x3012, "3XNN" },
+		{ 0x6012, "6XNN" }, { 0x7001, "7XNN" }, { 0x8014, "8XY4" }, { 0x801E, "8XYE" }, { 0xA300, "ANNN" },
+		{ 0xC0FF, "CXNN" }, { 0xE09E, "EX9E" }, { 0xF01E, "FX1E" }, { 0xF029, "FX29" }, { 0xF033, "FX33" },
+		{ 0xF555, "FX55" }, { 0xF565, "FX65" }
+	};
+
+	std::vector<Benchmark> benchmarks;
+
+	// Block engine steps single instructions through decode cache, so only two engines differ here
+	for (int e = 0; e < 2; ++e)
+	{
+		for (const OpcodeName& opcode : opcodes)
+		{
+			Chip8::InterpreterEngine engine = engines[e].engine;
+			unsigned short value = opcode.opcode;
+			benchmarks.push_back({ std::string("Opcode/") + opcode.name + "/" + engines[e].name,
+				[engine, value](BenchmarkState& state) { Chip8Benchmark::Opcode(state, engine, value); } });
+		}
+	}
+
+	const unsigned char heights[] = { 1, 5, 8, 15 };
+	for (unsigned char height : heights)
+	{
+		benchmarks.push_back({ "DXYN/height:" + std::to_string(height),
+			[height](BenchmarkState& state) { Chip8Benchmark::Sprite(state, 10, height); } });
+	}
+
+	benchmarks.push_back({ "DXYN/height:8/clipped", [](BenchmarkState& state) { Chip8Benchmark::Sprite(state, 60, 8); } });
+	benchmarks.push_back({ "Render/ScreenImage", [](BenchmarkState& state) { Chip8Benchmark::ScreenImage(state); } });
+	benchmarks.push_back({ "Render/Convert", [](BenchmarkState& state) { ConvertScreen(state, ConvertRows); } });
+	benchmarks.push_back({ "Render/Convert/scalar", [](BenchmarkState& state) { ConvertScreen(state, ConvertRowsScalar); } });
+
+	struct ScaleName { ScaleOptions options; const char* name; };
+	const ScaleName scales[] = {
+		{ { 1,  SCALE_NEAREST, false }, "nearest:x1" },
+		{ { 10, SCALE_NEAREST, false }, "nearest:x10" },
+		{ { 10, SCALE_NEAREST, true },  "nearest:x10/scanlines" },
+		{ { 2,  SCALE_EPX,     false }, "epx:x2" },
+		{ { 10, SCALE_EPX,     false }, "epx:x10" }
+	};
+
+	for (const ScaleName& scale : scales)
+	{
+		ScaleOptions options = scale.options;
+		benchmarks.push_back({ std::string("Scale/") + scale.name, [options](BenchmarkState& state) { ScaleScreen(state, options); } });
+	}
+
+	std::vector<std::string> romPaths;
+	if (!ListROMs(romDirectory, romPaths))
+		return benchmarks;
+
+	for (const std::string& romPath : romPaths)
+	{
+		std::string romName = romPath.substr(romPath.find_last_of("/\\") + 1);
+
+		for (const EngineName& engineName : engines)
+		{
+			Chip8::InterpreterEngine engine = engineName.engine;
+			benchmarks.push_back({ "ROM/" + romName + "/" + engineName.name,
+				[romPath, engine](BenchmarkState& state) { RunROM(state, romPath, engine); } });
+		}
+	}
+
+	return benchmarks;
+}
+
+/* Runs benchmark with growing iteration count until one run takes at least minTime. */
+static BenchmarkResult RunBenchmark(const Benchmark& benchmark, double minTime)
+{
+	BenchmarkResult result;
+	result.name = benchmark.name;
+
+	for (unsigned long long iterations = 1; ; )
+	{
+		BenchmarkState state(iterations);
+		benchmark.run(state);
+
+		double realSeconds = state.RealSeconds();
+		double cpuSeconds = state.CPUSeconds();
+
+		if (realSeconds >= minTime || iterations >= MAX_ITERATIONS)
+		{
+			result.iterations = iterations;
+			result.realTime = realSeconds * 1e9 / iterations;
+			result.cpuTime = cpuSeconds * 1e9 / iterations;
+			result.itemsPerSecond = (realSeconds > 0.0) ? state.ItemsPerIteration() * iterations / realSeconds : 0.0;
+			return result;
+		}
+
+		// Aim a bit over minTime from what this run took, at most 10x more
+		double scale = (realSeconds > 0.0) ? minTime * 1.4 / realSeconds : 10.0;
+		if (scale > 10.0)
+			scale = 10.0;
+
+		unsigned long long next = (unsigned long long)(iterations * scale);
+		iterations = (next > iterations) ? next : iterations + 1;
+	}
+}
+
+/* Quotes text for JSON, Windows paths are full of backslashes. */
+static std::string JSONString(const std::string& text)
+{
+	std::string quoted = "\"";
+	for (char c : text)
+	{
+		if (c == '\\' || c == '"')
+			quoted += '\\';
+		quoted += c;
+	}
+
+	return quoted + "\"";
+}
+
+/* Writes results in the same layout as Google Benchmark --benchmark_format=json,
+ * so the same comparison scripts work on it. */
+static bool WriteJSON(const std::string& jsonPath, const char* executable, double minTime, const std::vector<BenchmarkResult>& results)
+{
+	std::ofstream json(jsonPath);
+	if (!json)
+	{
+		LOG_ERROR("Error (benchmark): Can't open " + jsonPath);
+		return false;
+	}
+
+#ifdef NDEBUG
+	const char* buildType = "release";
+#else
+	const char* buildType = "debug";
+#endif
+
+	json << "{\n";
+	json << "  \"context\": {\n";
+	json << "    \"executable\": " << JSONString(executable) << ",\n";
+	json << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+	json << "    \"min_time\": " << minTime << ",\n";
+	json << "    \"library_build_type\": \"" << buildType << "\"\n";
+	json << "  },\n";
+	json << "  \"benchmarks\": [\n";
+
+	char number[64];
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchmarkResult& result = results[i];
+
+		json << "    {\n";
+		json << "      \"name\": " << JSONString(result.name) << ",\n";
+		json << "      \"iterations\": " << result.iterations << ",\n";
+		snprintf(number, sizeof(number), "%.3f", result.realTime);
+		json << "      \"real_time\": " << number << ",\n";
+		snprintf(number, sizeof(number), "%.3f", result.cpuTime);
+		json << "      \"cpu_time\": " << number << ",\n";
+		json << "      \"time_unit\": \"ns\"";
+
+		if (result.itemsPerSecond > 0.0)
+		{
+			snprintf(number, sizeof(number), "%.0f", result.itemsPerSecond);
+			json << ",\n      \"items_per_second\": " << number;
+		}
+
+		json << "\n    }" << ((i + 1 < results.size()) ? "," : "") << "\n";
+	}
+
+	json << "  ]\n";
+	json << "}\n";
+
+	if (!json)
+	{
+		LOG_ERROR("Error (benchmark): Can't write " + jsonPath);
+		return false;
+	}
+
+	return true;
+}
+
+/* Runs micro benchmarks of single instructions, sprite drawing and screen conversion and
+ * macro benchmarks of every ROM in ROM directory on every engine. */
+int main(int argc, char* argv[])
+{
+	std::string romDirectory = "../ROMs";						// ROMs folder seen from project directory
+	std::string jsonPath = "";
+	std::string filter = "";
+	double minTime = DEFAULT_MIN_TIME;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--roms" && i + 1 < argc)
+			romDirectory = argv[++i];
+		else if (arg == "--json" && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (arg == "--filter" && i + 1 < argc)
+			filter = argv[++i];
+		else if (arg == "--min-time" && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else
+		{
+			std::cout << "Usage: CHIP-8_Benchmark [--roms <dir>] [--filter <text>] [--min-time <s>] [--json <file>]" << std::endl;
+			return 1;
+		}
+	}
+
+	// Constructor and LoadROM of ROM benchmarks log every time benchmark is run
+	SetLogLevel(LOG_LEVEL_ERROR);
+
+	std::vector<BenchmarkResult> results;
+	printf("%-36s %14s %14s %12s %16s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "Items/s");
+
+	for (const Benchmark& benchmark : RegisterBenchmarks(romDirectory))
+	{
+		if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+			continue;
+
+		BenchmarkResult result = RunBenchmark(benchmark, minTime);
+		printf("%-36s %14.1f %14.1f %12llu %16.0f\n", result.name.c_str(), result.realTime, result.cpuTime,
+			result.iterations, result.itemsPerSecond);
+		fflush(stdout);
+
+		results.push_back(result);
+	}
+
+	if (!jsonPath.empty() && !WriteJSON(jsonPath, argv[0], minTime, results))
+		return 1;
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "BatchRunner.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Jobs of one worker. Owner takes jobs from the back, other workers steal from the front.
+struct WorkQueue
+{
+	std::mutex mutex;
+	std::deque<size_t> jobs;
+};
+
+struct BatchJobResult
+{
+	bool loaded;
+	HeadlessResult run;
+};
+
+/* Fills romPaths with all files in directory, or with lines of list file. */
+bool ListROMs(const std::string& path, std::vector<std::string>& romPaths)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path.c_str());
+	bool isDirectory = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat info;
+	bool isDirectory = stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+
+	if (!isDirectory)
+	{
+		std::ifstream listFile(path);
+		if (!listFile)
+		{
+			LOG_ERROR("Error (batch): Can't open " + path);
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(listFile, line))
+		{
+			if (!line.empty() && line[0] != '#')
+				romPaths.push_back(line);
+		}
+
+		return true;
+	}
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE search = FindFirstFileA((path + "\\*").c_str(), &entry);
+	if (search == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			romPaths.push_back(path + "\\" + entry.cFileName);
+	} while (FindNextFileA(search, &entry));
+
+	FindClose(search);
+#else
+	DIR* directory = opendir(path.c_str());
+	if (directory == nullptr)
+		return false;
+
+	while (dirent* entry = readdir(directory))
+	{
+		std::string romPath = path + "/" + entry->d_name;
+		if (stat(romPath.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+			romPaths.push_back(romPath);
+	}
+
+	closedir(directory);
+#endif
+
+	std::sort(romPaths.begin(), romPaths.end());
+	return true;
+}
+
+/* Takes next job, first from worker's own queue and then from other workers. */
+static bool TakeJob(std::vector<WorkQueue>& queues, size_t worker, size_t& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues[worker].mutex);
+		if (!queues[worker].jobs.empty())
+		{
+			job = queues[worker].jobs.back();
+			queues[worker].jobs.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < queues.size(); ++i)
+	{
+		WorkQueue& victim = queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Runs one ROM on its own Chip8 instance. */
+static BatchJobResult RunJob(const std::string& romPath, const BatchOptions& options)
+{
+	BatchJobResult result;
+
+	std::unique_ptr<Chip8> chip(new Chip8());
+	result.loaded = chip->LoadROM(romPath);
+	if (!result.loaded)
+		return result;
+
+	chip->SetTranslatedProgram(options.translatedProgram);
+	chip->SetEngine(options.engine);
+	chip->SetInstructionsPerSecond(options.instructionsPerSecond);
+	chip->SetIdleSkipping(options.idleSkipping);
+	if (options.seeded)
+		chip->SetRandomSeed(options.seed);
+
+	result.run = RunHeadless(*chip, options.run);
+	return result;
+}
+
+static std::string FileName(const std::string& path)
+{
+	size_t separator = path.find_last_of("/\\");
+	return (separator == std::string::npos) ? path : path.substr(separator + 1);
+}
+
+/* Runs every ROM headless on pool of worker threads and prints results per ROM and in total.
+ * Returns false if any ROM couldn't be loaded. */
+bool RunBatch(const std::vector<std::string>& romPaths, const BatchOptions& options)
+{
+	size_t threadCount = (options.threads != 0) ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, std::max<size_t>(romPaths.size(), 1));
+
+	std::vector<WorkQueue> queues(threadCount);
+	for (size_t i = 0; i < romPaths.size(); ++i)
+		queues[i % threadCount].jobs.push_back(i);
+
+	std::vector<BatchJobResult> results(romPaths.size());
+	auto startTime = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (size_t worker = 0; worker < threadCount; ++worker)
+	{
+		workers.push_back(std::thread([&, worker]()
+		{
+			size_t job;
+			while (TakeJob(queues, worker, job))
+				results[job] = RunJob(romPaths[job], options);
+		}));
+	}
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	bool allLoaded = true;
+	unsigned long long totalCycles = 0;
+	unsigned long long totalExecuted = 0;
+
+	// Speed counts only executed instructions, idle cycles are skipped without running them
+	printf("%-20s %14s %14s %14s %14s %12s\n", "ROM", "cycles", "executed", "idle", "instr/s", "framebuffer");
+	for (size_t i = 0; i < romPaths.size(); ++i)
+	{
+		const BatchJobResult& result = results[i];
+		if (!result.loaded)
+		{
+			printf("%-20s %14s\n", FileName(romPaths[i]).c_str(), "load failed");
+			allLoaded = false;
+			continue;
+		}
+
+		unsigned long long executed = result.run.cycles - result.run.idleCycles;
+		double instructionsPerSecond = (result.run.seconds > 0.0) ? executed / result.run.seconds : 0.0;
+		printf("%-20s %14llu %14llu %14llu %14.0f %12.8X\n", FileName(romPaths[i]).c_str(), result.run.cycles, executed,
+			result.run.idleCycles, instructionsPerSecond, result.run.framebufferHash);
+		totalCycles += result.run.cycles;
+		totalExecuted += executed;
+	}
+
+	printf("total: %u ROMs, %u threads, %llu cycles, %llu executed, %.6f s, %.0f instructions/s\n", (unsigned int)romPaths.size(),
+		(unsigned int)threadCount, totalCycles, totalExecuted, seconds, (seconds > 0.0) ? totalExecuted / seconds : 0.0);
+
+	return allLoaded;
+}
\ No newline at end of file
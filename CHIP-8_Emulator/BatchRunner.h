@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Cpu.h"
+#include "Headless.h"
+
+struct BatchOptions
+{
+	unsigned int threads;								// 0 for one thread per core
+	Chip8::InterpreterEngine engine;
+	unsigned int instructionsPerSecond;
+	bool seeded;										// false keeps time based seed of every Chip8
+	unsigned int seed;
+	bool idleSkipping;									// see Chip8::SetIdleSkipping
+	const TranslatedProgram* translatedProgram;			// used by ENGINE_TRANSLATED, ROMs it wasn't made from run untranslated
+	HeadlessOptions run;								// limits and input used for every ROM
+};
+
+bool ListROMs(const std::string& path, std::vector<std::string>& romPaths);
+bool RunBatch(const std::vector<std::string>& romPaths, const BatchOptions& options);
\ No newline at end of file
@@ -1,8 +1,31 @@
 #include "Cpu.h"
+#include "FramePacer.h"
+#include "Jit.h"
+#include "Log.h"
+#include "Movie.h"
+#include "PixelConverter.h"
+#include "Profiler.h"
+#include "RewindBuffer.h"
 #include "SFML/Graphics.hpp"
+#include "VideoCapture.h"
 #include <iostream>
 #include <fstream>
+#include <cstring>
 #include <ctime>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+/* Formats value as hex number, e.g. 0x00E0. */
+static std::string ToHex(unsigned short value)
+{
+	std::ostringstream stream;
+	stream << "0x" << std::hex << std::uppercase;
+	stream.width(4);
+	stream.fill('0');
+	stream << value;
+	return stream.str();
+}
 
 const unsigned char Chip8::fontset[FONTSET_SIZE] =
 {
@@ -30,9 +53,31 @@ Chip8::Chip8()
 	opcode = 0;
 	I = 0;
 	sp = 0;
-	pc = 0x200;		// ROM will be loaded at this location in memory
+	pc = ROM_START;		// ROM will be loaded at this location in memory
 	
 	drawFlag = true;
+	dirtyRows = ALL_ROWS;
+	screenUploaded = false;
+	emulationRunning = false;
+	pendingRows = 0;
+	palette = DefaultPalette();
+	scaleOptions = DefaultScaleOptions();
+	presentMode = PRESENT_FRAME;
+	screenshotCount = 0;
+	rewinding = false;
+
+	engine = ENGINE_DECODE_CACHE;
+	dispatchTable = nullptr;
+	translatedProgram = nullptr;
+	tracer = nullptr;
+	profiler = nullptr;
+	movie = nullptr;
+	videoCapture = nullptr;
+	cycleCount = 0;
+	idleCyclesSkipped = 0;
+	idleSkipping = true;
+	instructionsPerSecond = DEFAULT_INSTRUCTIONS_PER_SECOND;
+	timerPhase = 0;
 
 	// Prepare data storages
 	for (int i = 0; i < NUM_REGISTERS; ++i)
@@ -47,7 +92,7 @@ Chip8::Chip8()
 	for (int i = 0; i < MEMORY_SIZE; ++i)
 		memory[i] = 0;
 
-	for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i)
+	for (int i = 0; i < SCREEN_HEIGHT; ++i)
 		gfx[i] = 0;
 
 	for (int i = 80, j = 0; j < FONTSET_SIZE; ++i, ++j)
@@ -57,9 +102,11 @@ Chip8::Chip8()
 	soundTimer = 0; 
 	delayTimer = 0;
 
-	srand(time(NULL));
+	ResetDecodeCache();
+
+	SetRandomSeed((unsigned int)time(NULL));
 
-	Log("Chip8 initialized.");
+	LOG_INFO("Chip8 initialized.");
 }
 
 Chip8::~Chip8()
@@ -72,86 +119,303 @@ Chip8::~Chip8()
 bool Chip8::LoadROM(const std::string& romPath)
 {
 	std::ifstream inputFile(romPath, std::ios_base::binary);
+	if (!inputFile)
+	{
+		LOG_ERROR("Error loading ROM: Can't open " + romPath);
+		return false;
+	}
 
-	// Start filling memory from location 512
-	int memLoc = 512;
-	while (!inputFile.eof())
+	// ROM may fill whole memory from location 512 to the end
+	inputFile.seekg(0, std::ios_base::end);
+	std::streamoff romSize = inputFile.tellg();
+	inputFile.seekg(0, std::ios_base::beg);
+	if (romSize < 0 || romSize > MEMORY_SIZE - ROM_START)
 	{
-		if (memLoc > MEMORY_SIZE)
-		{
-			Log("Error loading ROM: Not enough space in memory!");
-			return false;
-		}
+		LOG_ERROR("Error loading ROM: Not enough space in memory!");
+		return false;
+	}
 
-		unsigned char data = 0;
-		inputFile.read((char*)&data, sizeof(unsigned char));
-		
-		memory[memLoc] = data;
-		++memLoc;
+	// Start filling memory from location 512
+	inputFile.read((char*)&memory[ROM_START], romSize);
+	if (inputFile.gcount() != romSize)
+	{
+		LOG_ERROR("Error loading ROM: Can't read " + romPath);
+		return false;
 	}
 
 	inputFile.close();
+	ResetDecodeCache();
+	statePath = romPath + ".state";
+	screenshotPrefix = romPath;
 
-	Log("ROM loaded successfully.");
+	LOG_INFO("ROM loaded successfully.");
 	return true;
 }
 
 /* Main loop of emulator. Loop is active until user closes the window. */
 void Chip8::MainLoop()
 {
-	unsigned int newWidth  = SCREEN_WIDTH  * MULTIPLIER;
-	unsigned int newHeight = SCREEN_HEIGHT * MULTIPLIER;
-
-	sf::RenderWindow window(sf::VideoMode(SCREEN_WIDTH, SCREEN_HEIGHT), "Chip8");
-	window.setSize(sf::Vector2u(newWidth, newHeight)); // @Hack: make window and rendering picture bigger w/out changing resolution in CPU
+	// Screen is scaled on CPU, window and texture are at final size and show pixels 1:1
+	upscaler.reset(new Upscaler(scaleOptions));
+	sf::RenderWindow window(sf::VideoMode(upscaler->Width(), upscaler->Height()), "Chip8");
+	window.setVerticalSyncEnabled(presentMode == PRESENT_VBLANK);
 	//window.setFramerateLimit(180); // Real Chip8 works at 60Hz, this is SFML frame limiter
+
+	// Texture lives as long as window, Render only updates it's pixels
+	screenTexture.reset(new sf::Texture());
+	screenTexture->create(upscaler->Width(), upscaler->Height());
+	screenSprite.setTexture(*screenTexture, true);
+	screenUploaded = false;
+	pendingRows.store(0, std::memory_order_relaxed);
 	
+	// Emulation runs on its own thread, this one only presents finished frames and polls events
+	rewindBuffer.reset(new RewindBuffer());
+	rewinding = false;
+
+	emulationRunning.store(true, std::memory_order_release);
+	std::thread emulation(&Chip8::EmulationLoop, this);
+
+	// Window thread sleeps until emulation publishes, emulation thread paces all present modes.
+	// With vertical sync display() in Render also waits for vblank.
 	while (window.isOpen())
 	{
-		EmulateCycle();
+		HandleEvents(window);
+		WaitForScreen();
+
+		// Rows are taken before the frame. Emulation thread adds rows only after it published
+		// their frame, so frame taken next always contains every taken row.
+		uint32_t rows = pendingRows.exchange(0, std::memory_order_acquire);
+		if (frames.Update() || rows != 0)
+			Render(window, frames.ReadBuffer(), rows);
+	}
+
+	emulationRunning.store(false, std::memory_order_release);
+	emulation.join();
+
+	rewindBuffer.reset();
+	screenTexture.reset();
+	upscaler.reset();
+}
+
+/* Runs on emulation thread while window is open. Every iteration is one 60 Hz frame: apply
+ * key events from window thread, emulate the frame (or step one frame back while rewinding),
+ * publish screen if it changed and sleep until the next one. */
+void Chip8::EmulationLoop()
+{
+	FramePacer pacer(TIMER_FREQUENCY);
+
+	while (emulationRunning.load(std::memory_order_acquire))
+	{
+		InputEvent event;
+		while (inputQueue.Pop(event))
+			ApplyInput(event);
+
+		if (rewinding)
+		{
+			RewindFrame();
+		}
+		else
+		{
+			if (presentMode == PRESENT_IMMEDIATE)
+				EmulateFrameImmediate();
+			else
+				EmulateFrame();
+
+			RecordRewindFrame();
+
+			if (movie != nullptr)
+				++movie->frames;
+		}
 
 		if (drawFlag)
-			Render(window);
+			PublishFrame();
 
-		HandleEvents(window);
+		// Full queue means encoder fell behind, frame is dropped rather than stalling emulation
+		if (videoCapture != nullptr)
+			videoCapture->AddFrame(gfx, false);
+
+		pacer.Wait();
+	}
+}
+
+/* Emulates current 60 Hz frame one cycle at a time and publishes screen after every cycle
+ * which drew, so window can show sprites as they are drawn. */
+void Chip8::EmulateFrameImmediate()
+{
+	for (unsigned int count = CyclesUntilTimerTick(); count > 0; --count)
+	{
+		EmulateCycles(1);
+
+		if (drawFlag)
+			PublishFrame();
 	}
 }
 
-/* Fill Uint8 array. This array is used to create sf::Image object which is going to be drawn. */
-void Chip8::Render(sf::RenderWindow& window)
+/* Applies key change or command from window thread. Runs on emulation thread. */
+void Chip8::ApplyInput(const InputEvent& event)
 {
-	for (int i = 0, j = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i, j += 4)
+	switch (event.type)
 	{
-		// Pixel is activated
-		if (gfx[i] != 0)
+	case INPUT_KEY:
+		SetKey(event.key, event.state);
+
+		if (movie != nullptr)
 		{
-			screenImage[j]     = 255; // Red
-			screenImage[j + 1] = 255; // Green
-			screenImage[j + 2] = 255; // Blue
-			screenImage[j + 3] = 255; // Alpha
+			KeyEvent keyEvent = { movie->frames, event.key, event.state };
+			movie->input.push_back(keyEvent);
 		}
-		else
+		break;
+
+	case INPUT_SAVE_STATE:
+		SaveState(statePath);
+		break;
+
+	case INPUT_LOAD_STATE:
+		if (movie != nullptr)
+		{
+			LOG_WARNING("Warning (movie): Loading state is disabled while recording.");
+			break;
+		}
+
+		LoadState(statePath);
+		rewindBuffer->Clear();
+		break;
+
+	case INPUT_REWIND:
+		if (movie != nullptr)
 		{
-			screenImage[j]     = 0; // Red
-			screenImage[j + 1] = 0; // Green
-			screenImage[j + 2] = 0; // Blue
-			screenImage[j + 3] = 255; // Alpha
+			LOG_WARNING("Warning (movie): Rewind is disabled while recording.");
+			break;
 		}
+
+		rewinding = (event.state != 0);
+		break;
 	}
+}
 
-	sf::Image image;
-	image.create(SCREEN_WIDTH, SCREEN_HEIGHT, screenImage);
+/* Adds state after emulated frame to rewind history. */
+void Chip8::RecordRewindFrame()
+{
+	MachineState state;
+	Snapshot(state);
+	rewindBuffer->Push(state);
+}
 
-	sf::Texture texture;
-	texture.loadFromImage(image);
-	sf::Sprite sprite;
-	sprite.setTexture(texture, true);
+/* Goes one frame back in rewind history. Keys keep their current state, otherwise keys
+ * held back then would stay pressed after rewinding stops. */
+void Chip8::RewindFrame()
+{
+	MachineState state;
+	if (!rewindBuffer->StepBack(state))
+		return;
+
+	unsigned char heldKeys[NUM_KEYS];
+	memcpy(heldKeys, key, sizeof(key));
+
+	Restore(state);
+	memcpy(key, heldKeys, sizeof(key));
+}
+
+/* Copies screen to triple buffer, window thread picks it up on its next iteration. Dirty rows
+ * are added to pendingRows after publishing, window thread may skip frames but not their rows. */
+void Chip8::PublishFrame()
+{
+	memcpy(frames.WriteBuffer().gfx, gfx, sizeof(gfx));
+	frames.Publish();
+	pendingRows.fetch_or(dirtyRows, std::memory_order_release);
+
+	// Window thread checks pendingRows while holding the lock, so rows added here are either
+	// seen by that check or the notification comes after it started waiting
+	{
+		std::lock_guard<std::mutex> lock(screenMutex);
+	}
+	screenPublished.notify_one();
+
+	drawFlag = false;
+	dirtyRows = 0;
+}
+
+/* Sleeps on window thread until emulation thread publishes screen with new rows, but at most
+ * EVENT_POLL_INTERVAL, so window events are handled even when ROM draws nothing. */
+void Chip8::WaitForScreen()
+{
+	std::unique_lock<std::mutex> lock(screenMutex);
+	screenPublished.wait_for(lock, std::chrono::milliseconds(EVENT_POLL_INTERVAL),
+		[this] { return pendingRows.load(std::memory_order_relaxed) != 0; });
+}
+
+/* Draws frame to window. Only dirty rows which differ from texture are scaled and uploaded,
+ * each run of adjacent rows with one texture update. */
+void Chip8::Render(sf::RenderWindow& window, const ScreenFrame& frame, uint32_t rows)
+{
+	if (!screenUploaded)
+	{
+		rows = ALL_ROWS;
+	}
+	else
+	{
+		// Sprite drawn and erased again within frame leaves row marked but unchanged
+		for (int y = 0; y < SCREEN_HEIGHT; ++y)
+			if (frame.gfx[y] == uploadedGfx[y])
+				rows &= ~(1u << y);
+	}
+
+	rows = upscaler->Scale(frame.gfx, rows, palette);
+	memcpy(uploadedGfx, frame.gfx, sizeof(frame.gfx));
+
+	int y = 0;
+	while (y < SCREEN_HEIGHT)
+	{
+		if ((rows & (1u << y)) == 0)
+		{
+			++y;
+			continue;
+		}
+
+		int end = y + 1;
+		while (end < SCREEN_HEIGHT && (rows & (1u << end)) != 0)
+			++end;
+
+		UploadRows(y, end - y);
+		y = end;
+	}
+
+	screenUploaded = true;
 
 	window.clear();
-	window.draw(sprite);
+	window.draw(screenSprite);
 	window.display();
 }
 
+/* Scales whole frame to RGBA image which is uploaded to screen texture. */
+void Chip8::UpdateScreenImage(const ScreenFrame& frame)
+{
+	upscaler->Scale(frame.gfx, ALL_ROWS, palette);
+}
+
+/* Updates only the strip of texture which shows rowCount screen rows starting at firstRow. */
+void Chip8::UploadRows(int firstRow, int rowCount)
+{
+	unsigned int factor = upscaler->Options().factor;
+	screenTexture->update(upscaler->Row(firstRow * factor), upscaler->Width(), rowCount * factor, 0, firstRow * factor);
+}
+
+/* Saves screen as it is shown in window, at window size, next to loaded ROM. */
+void Chip8::SaveScreenshot()
+{
+	sf::Image image;
+	image.create(upscaler->Width(), upscaler->Height(), upscaler->Pixels());
+
+	std::string path = screenshotPrefix + "_" + std::to_string(++screenshotCount) + ".png";
+	if (!image.saveToFile(path))
+	{
+		LOG_ERROR("Error saving screenshot: Can't write " + path);
+		return;
+	}
+
+	LOG_INFO("Screenshot saved to " + path);
+}
+
 /* Method for handling events. Right now events of interest
  * are closed, keypressed and keyreleased*/
 void Chip8::HandleEvents(sf::RenderWindow& window)
@@ -166,394 +430,1140 @@ void Chip8::HandleEvents(sf::RenderWindow& window)
 			break;
 
 		case sf::Event::KeyPressed:
-			SwitchKeyState(event.key.code, 1);
+			if (event.key.code == sf::Keyboard::F5)
+				QueueCommand(INPUT_SAVE_STATE);
+			else if (event.key.code == sf::Keyboard::F9)
+				QueueCommand(INPUT_LOAD_STATE);
+			else if (event.key.code == sf::Keyboard::BackSpace)
+				QueueCommand(INPUT_REWIND, 1);
+			else if (event.key.code == sf::Keyboard::F12)
+				SaveScreenshot();
+			else
+				SwitchKeyState(event.key.code, 1);
 			break;
 
 		case sf::Event::KeyReleased:
-			SwitchKeyState(event.key.code, 0);
+			if (event.key.code == sf::Keyboard::BackSpace)
+				QueueCommand(INPUT_REWIND, 0);
+			else
+				SwitchKeyState(event.key.code, 0);
 			break;
 
 		default:
-			Log("Warning (HandleEvent): There's no handler for that event.");
+			LOG_TRACE("Warning (HandleEvent): There's no handler for that event.");
 		}
 	}
 }
 
-/* Switches keystate of key. */
+/* Switches keystate of key. Change reaches emulation thread through input queue. */
 void Chip8::SwitchKeyState(sf::Keyboard::Key pressedKey, int state)
 {
 	switch (pressedKey)
 	{
 	case sf::Keyboard::Num1:
-		key[0] = state;
+		QueueKey(0, state);
 		break;
 	case sf::Keyboard::Num2:
-		key[1] = state;
+		QueueKey(1, state);
 		break;
 	case sf::Keyboard::Num3:
-		key[2] = state;
+		QueueKey(2, state);
 		break;
 	case sf::Keyboard::Num4:
-		key[3] = state;
+		QueueKey(3, state);
 		break;
 	case sf::Keyboard::Q:
-		key[4] = state;
+		QueueKey(4, state);
 		break;
 	case sf::Keyboard::W:
-		key[5] = state;
+		QueueKey(5, state);
 		break;
 	case sf::Keyboard::E:
-		key[6] = state;
+		QueueKey(6, state);
 		break;
 	case sf::Keyboard::R:
-		key[7] = state;
+		QueueKey(7, state);
 		break;
 	case sf::Keyboard::A:
-		key[8] = state;
+		QueueKey(8, state);
 		break;
 	case sf::Keyboard::S:
-		key[9] = state;
+		QueueKey(9, state);
 		break;
 	case sf::Keyboard::D:
-		key[10] = state;
+		QueueKey(10, state);
 		break;
 	case sf::Keyboard::F:
-		key[11] = state;
+		QueueKey(11, state);
 		break;
 	case sf::Keyboard::Z:
-		key[12] = state;
+		QueueKey(12, state);
 		break;
 	case sf::Keyboard::X:
-		key[13] = state;
+		QueueKey(13, state);
 		break;
 	case sf::Keyboard::C:
-		key[14] = state;
+		QueueKey(14, state);
 		break;
 	case sf::Keyboard::V:
-		key[15] = state;
+		QueueKey(15, state);
 		break;
 	default:
-		Log("Error (Keyboard): Wrong key code.");
+		LOG_WARNING("Error (Keyboard): Wrong key code.");
 	}
 }
 
-/* 1 cycle of emulation. Fetch opcode, decode, execute and update timers. */
+/* Passes key change to emulation thread, it's applied at the start of next emulated frame. */
+void Chip8::QueueKey(unsigned char chip8Key, int state)
+{
+	InputEvent event;
+	event.type  = INPUT_KEY;
+	event.key   = chip8Key;
+	event.state = (unsigned char)state;
+
+	if (!inputQueue.Push(event))
+		LOG_WARNING("Warning (Keyboard): Input queue is full, key event dropped.");
+}
+
+/* Passes command to emulation thread, so it runs between emulated frames. */
+void Chip8::QueueCommand(InputEventType type, unsigned char state)
+{
+	InputEvent event;
+	event.type  = (unsigned char)type;
+	event.key   = 0;
+	event.state = state;
+
+	if (!inputQueue.Push(event))
+		LOG_WARNING("Warning (Keyboard): Input queue is full, command dropped.");
+}
+
+/* Sets state of Chip8 key (0 - F), 1 is pressed and 0 released. */
+void Chip8::SetKey(unsigned char chip8Key, int state)
+{
+	key[chip8Key & (NUM_KEYS - 1)] = state;
+}
+
+/* 1 cycle of emulation. Fetch opcode (only on decode cache miss), decode, execute and update timers. */
 void Chip8::EmulateCycle()
 {
-	opcode = FetchOpcode();
 	DecodeExecute();
 	UpdateTimers();
 }
 
-/* Decodes and executes Chip8 opcode */
-void Chip8::DecodeExecute()
+/* 1 cycle of emulation, recorded by tracer and profiler. Kept apart from EmulateCycle,
+ * so that runs without them don't pay for the checks. */
+void Chip8::InstrumentedCycle()
 {
-	switch (opcode & 0xF000)
+	if (tracer != nullptr)
+		TraceCycle();
+
+	if (profiler != nullptr)
+		profiler->Record(pc, FetchOpcode(), stack, sp, memory);
+
+	EmulateCycle();
+}
+
+/* Runs count cycles of emulation. Block, translated and JIT engines execute whole basic blocks
+ * at once, other engines go cycle by cycle. Timers are updated after every instruction.
+ * Loops which only wait for key press or delay timer are skipped, see SkipIdleLoop. They are
+ * entered by a jump back (FX0A stays in place), so they are looked for only at the start and
+ * after control went backwards, not before every instruction.
+ * While tracing or profiling every engine goes cycle by cycle and nothing is skipped,
+ * so that every instruction is recorded. */
+void Chip8::EmulateCycles(unsigned int count)
+{
+	if (tracer != nullptr || profiler != nullptr)
 	{
-	case 0x0000:
-		switch (opcode & 0x000F)
+		for (unsigned int i = 0; i < count; ++i)
+			InstrumentedCycle();
+
+		return;
+	}
+
+	bool lookForIdle = idleSkipping;
+
+	while (count > 0)
+	{
+		if (lookForIdle)
 		{
-		case 0x0000: // Display, clears the screen
-			for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i)
-				gfx[i] = 0;
+			count -= SkipIdleLoop(count);
+			if (count == 0)
+				break;
+		}
 
-			drawFlag = true;
-			UpdatePC();
-			Log("[00E0] Display, clear the screen");
-			break;
+		unsigned short start = pc;
+		count -= ExecuteNext(count);
+		lookForIdle = idleSkipping && pc <= start;
+	}
+}
 
-		case 0x000E: // Flow, returns from subroutine
-			--sp;
-			pc = stack[sp];
-			UpdatePC(); // @TODO: Correct ?!
-			Log("[00EE] Flow, return from subroutine");
-			break;
+/* Runs translated block, cached or compiled block or single instruction at pc, whichever
+ * the engine uses and fits in count cycles. Returns number of executed cycles. */
+unsigned int Chip8::ExecuteNext(unsigned int count)
+{
+	if (engine == ENGINE_TRANSLATED)
+	{
+		const TranslatedBlock* block = translatedBlocks[pc];
 
-		default:
-			Log("Error (decode): Bad opcode (0x0000): " + opcode);
+		// Interpreter handles code which wasn't translated or was modified since
+		if (block != nullptr && block->length <= count)
+		{
+			block->run(*this);
+			return block->length;
+		}
+	}
+	else if (engine == ENGINE_BLOCK_CACHE || engine == ENGINE_JIT)
+	{
+		unsigned int length = blockLength[pc];
+		if (length == 0)
+		{
+			length = BuildBlock(pc);
+			if (engine == ENGINE_JIT && length != 0)
+				jit->Compile(*this, pc, length);
 		}
-		break;
 
-	case 0x1000: // Flow, goto NNN
-		pc = opcode & 0x0FFF;
-		Log("[1NNN] Flow, jump to NNN");
-		break;
+		// Block doesn't fit in remaining cycles or memory, finish one instruction at a time
+		if (length != 0 && length <= count)
+		{
+			if (engine == ENGINE_JIT)
+				jit->Block(pc)(this, this);
+			else
+				ExecuteBlock(pc, length);
 
-	case 0x2000: // Flow, calls subroutine at NNN
-		stack[sp] = pc;
-		++sp;
-		pc = opcode & 0x0FFF;
-		Log("[2NNN] Flow, calls subroutine at NNN");
-		break;
+			return length;
+		}
+	}
 
-	case 0x3000: // Cond [0x3xNN], if (Vx == NN), skips 1 instruction
-		(V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) ? pc += 4 : UpdatePC();
-		Log("[3XNN] Cond, skips instr. if VX==NN");
-		break;
+	EmulateCycle();
+	return 1;
+}
 
-	case 0x4000: // Cond [0x4xNN], if (Vx != NN), skips 1 instruction
-		(V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) ? pc += 4 : UpdatePC();
-		Log("[4XNN] Cond, skips instr. if VX!=NN");
-		break;
+/* Recognizes loops in which ROM only waits and skips up to count of their cycles at once,
+ * leaving machine in the same state as executing them would. Recognized loops are
+ * FX0A while no key is pressed, jump to itself and delay timer polling:
+ *     FX07        VX = delay timer
+ *     3XNN/4XNN   skip jump when VX == NN / VX != NN
+ *     1NNN        jump back to FX07
+ * Keys don't change during EmulateCycles, so first two wait for all count cycles. Polling
+ * loop is skipped in whole iterations until the delay timer changes. Returns number of
+ * skipped cycles, 0 if pc isn't at start of idle loop. */
+unsigned int Chip8::SkipIdleLoop(unsigned int count)
+{
+	if (pc + 5 >= MEMORY_SIZE)
+		return 0;
 
-	case 0x5000: // Cond, if (Vx == Vy), skips 1 instruction
-		(V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 8]) ? pc += 4 : UpdatePC();
-		Log("[5XY0] Cond, skips instr. if VX==VY");
-		break;
+	unsigned short current = memory[pc] << 8 | memory[pc + 1];
+	unsigned short jumpToStart = 0x1000 | pc;
 
-	case 0x6000: // Const [0x6xNN], sets Vx to NN
-		V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-		Log("[6XNN] Const, set Vx = NN");
-		UpdatePC();
-		break;
+	if (current == jumpToStart)
+	{
+		SkipCycles(count);
+		return count;
+	}
 
-	case 0x7000: // Const [0x7xNN], adds NN to Vx
-		V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-		Log("[7XNN] Const, Vx += NN");
-		UpdatePC();
-		break;
+	if ((current & 0xF0FF) == 0xF00A)
+	{
+		for (int i = 0; i < NUM_KEYS; ++i)
+			if (key[i] != 0)
+				return 0;
 
-	case 0x8000: // Instructions group, [0x8xyZ], Z=0...7 and E
-		switch (opcode & 0x000F)
+		SkipCycles(count);
+		return count;
+	}
+
+	if ((current & 0xF0FF) != 0xF007)
+		return 0;
+
+	unsigned short compare = memory[pc + 2] << 8 | memory[pc + 3];
+	unsigned short jump = memory[pc + 4] << 8 | memory[pc + 5];
+	unsigned char x = (current & 0x0F00) >> 8;
+	unsigned char nn = compare & 0x00FF;
+
+	if (jump != jumpToStart || ((compare & 0x0F00) >> 8) != x)
+		return 0;
+
+	bool exits;
+	if ((compare & 0xF000) == 0x3000)
+		exits = (delayTimer == nn);
+	else if ((compare & 0xF000) == 0x4000)
+		exits = (delayTimer != nn);
+	else
+		return 0;
+
+	if (exits)
+		return 0;
+
+	// Every iteration whose FX07 runs before the next tick reads the same delay timer
+	unsigned int untilChange = (delayTimer == 0) ? count : CyclesUntilTimerTick();
+	unsigned int skipped = ((untilChange < count) ? untilChange : count) / 3 * 3;
+	if (skipped == 0)
+		return 0;
+
+	V[x] = delayTimer;
+	SkipCycles(skipped);
+	return skipped;
+}
+
+/* Advances cycle count and timers as if count cycles were executed. */
+void Chip8::SkipCycles(unsigned int count)
+{
+	cycleCount += count;
+	idleCyclesSkipped += count;
+
+	unsigned long long phase = timerPhase + (unsigned long long)TIMER_FREQUENCY * count;
+	unsigned long long ticks = phase / instructionsPerSecond;
+	timerPhase = (unsigned int)(phase % instructionsPerSecond);
+
+	delayTimer = (ticks < delayTimer) ? (unsigned char)(delayTimer - ticks) : 0;
+	soundTimer = (ticks < soundTimer) ? (unsigned char)(soundTimer - ticks) : 0;
+}
+
+/* Executes instruction at pc. With decode cache engine instructions are decoded only the
+ * first time they are executed, after that handler and operands are taken from the cache.
+ * With dispatch table engine opcode is fetched every time and looked up in the table.
+ * Block engine uses decode cache when stepping single instruction. */
+void Chip8::DecodeExecute()
+{
+	if (engine == ENGINE_DISPATCH_TABLE)
+	{
+		opcode = FetchOpcode();
+		dispatchTable[opcode](*this, opcode);
+		return;
+	}
+
+	DecodedInstruction& cached = decodeCache[pc];
+	if (cached.handler == nullptr)
+		cached = Decode(FetchOpcode());
+
+	// Copy, handler can invalidate it's own cache entry (FX33, FX55)
+	const DecodedInstruction instr = cached;
+
+	opcode = instr.opcode;
+	(this->*instr.handler)(instr);
+}
+
+/* Selects interpreter engine. Decode cache, block and translated engines share handlers
+ * below, dispatch table engine has its own specialized ones in DispatchTable.cpp. */
+void Chip8::SetEngine(InterpreterEngine newEngine)
+{
+	engine = newEngine;
+
+	if (engine == ENGINE_JIT)
+	{
+		if (!jit)
+			jit.reset(new JitCompiler());
+
+		// Win32 and other non x86-64 builds interpret blocks instead
+		if (!jit->Valid())
 		{
-		case 0x0000: // Assign, Vx = Vy
-			V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
-			UpdatePC();
-			Log("[8XY0] Assign, Vx = Vy");
-			break;
+			LOG_WARNING("Warning (jit): Native code isn't available, running block engine instead.");
+			engine = ENGINE_BLOCK_CACHE;
+		}
+	}
 
-		case 0x0001: // BitOp, Vx = Vx | Vy
-			V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x0F00) >> 4];
-			UpdatePC();
-			Log("[8XY1] BitOp, Vx = Vx | Vy");
-			break;
+	ResetDecodeCache(); // blocks are not tracked while other engines run
 
-		case 0x0002: // BitOp, Vx = Vx & Vy
-			V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x0F00) >> 4];
-			UpdatePC();
-			Log("[8XY2] BitOp, Vx = Vx & Vy");
-			break;
+	if (engine == ENGINE_DISPATCH_TABLE)
+		dispatchTable = DispatchTable();
+}
 
-		case 0x0003: // BitOp, Vx = Vx ^ Vy
-			V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x0F00) >> 4];
-			UpdatePC();
-			Log("[8XY3] BitOp, Vx = Vx ^ Vy");
-			break;
+/* Decodes straight-line run of instructions starting at address into decode cache.
+ * Block ends with first instruction which can change control flow or write to memory,
+ * that instruction is included in the block. Returns number of instructions in block. */
+unsigned int Chip8::BuildBlock(unsigned short start)
+{
+	unsigned int length = 0;
 
-		case 0x0004: // Math, Vx += Vy
-			if (V[(opcode & 0x0F00) >> 4] > 0xFF - V[(opcode & 0x0F00) >> 8])
-				V[CARRY_FLAG] = 1;
-			else
-				V[CARRY_FLAG] = 0;
+	for (unsigned int address = start; address + 1 < MEMORY_SIZE && length < MAX_BLOCK_LENGTH; address += 2)
+	{
+		DecodedInstruction& instr = decodeCache[address];
+		if (instr.handler == nullptr)
+			instr = Decode(memory[address] << 8 | memory[address + 1]);
 
-			V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x0F00) >> 4];
-			UpdatePC();
-			Log("[8XY4] Math, Vx += Vy w/CF");
+		++length;
+
+		if (EndsBlock(instr.handler))
 			break;
+	}
 
-		case 0x0005: // Math, Vx -= Vy
-			if (V[(opcode & 0x0F00) >> 8] < V[(opcode & 0x0F00) >> 4])
-				V[CARRY_FLAG] = 0;
-			else
-				V[CARRY_FLAG] = 1;
+	blockLength[start] = length;
+	for (unsigned int i = 0; i < length * 2; ++i)
+		blockCode[start + i] = true;
 
-			V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x0F00) >> 4];
-			UpdatePC();
-			Log("[8XY5] Math, Vx -= Vy w/CF");
-			break;
+	return length;
+}
 
-		case 0x0006: // BitOp, Shift Vy>>1 and copy result to Vx. Set VF to least sig.bit of VY before shift
-			V[CARRY_FLAG] = V[(opcode & 0x00F0) >> 4] & 0b00000001; // @TODO: Correct ?!!
-			V[(opcode & 0x00F0) >> 4] >>= 1;
-			V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
-			UpdatePC();
-			Log("[8XY6] BitOp, Vx=Vy=Vy>>1");
-			break;
+/* Executes length instructions of block starting at start. Only the last instruction
+ * in block can jump or write to memory, so all of them are still in decode cache. */
+void Chip8::ExecuteBlock(unsigned short start, unsigned int length)
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		// Copy, last instruction can invalidate it's own cache entry (FX33, FX55)
+		const DecodedInstruction instr = decodeCache[start + i * 2];
 
-		case 0x0007: // Math, Vx = Vy - Vx
-			if (V[(opcode & 0x0F00) >> 8] > V[(opcode & 0x0F00) >> 4])
-				V[CARRY_FLAG] = 0;
-			else
-				V[CARRY_FLAG] = 1;
+		opcode = instr.opcode;
+		(this->*instr.handler)(instr);
+		UpdateTimers();
+	}
+}
 
-			V[V[(opcode & 0x0F00) >> 8]] = V[(opcode & 0x00F0) >> 4] - V[(opcode & 0x0F00) >> 8];
-			UpdatePC();
-			Log("[8XY7] Math, Vx = Vy - Vx");
-			break;
+/* Instructions after which execution doesn't simply continue at next address,
+ * or which can modify code that follows them. */
+bool Chip8::EndsBlock(OpcodeHandler handler)
+{
+	return handler == &Chip8::Op00EE || handler == &Chip8::Op1NNN || handler == &Chip8::Op2NNN
+		|| handler == &Chip8::Op3XNN || handler == &Chip8::Op4XNN || handler == &Chip8::Op5XY0
+		|| handler == &Chip8::Op9XY0 || handler == &Chip8::OpBNNN || handler == &Chip8::OpEX9E
+		|| handler == &Chip8::OpEXA1 || handler == &Chip8::OpFX0A || handler == &Chip8::OpFX33
+		|| handler == &Chip8::OpFX55 || handler == &Chip8::OpUnknown;
+}
 
-		case 0x000E: // BitOp, Vx=Vy=Vy<<1
-			V[CARRY_FLAG] = V[(opcode & 0x00F0) >> 4] & 0b00000001; // @TODO: Correct ?!!
-			V[(opcode & 0x00F0) >> 4] <<= 1;
-			V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
-			UpdatePC();
-			Log("[8XYE] BitOp, Vx=Vy=Vy<<1");
-			break;
+/* Sets ROM translated ahead of time, used by ENGINE_TRANSLATED. */
+void Chip8::SetTranslatedProgram(const TranslatedProgram* program)
+{
+	translatedProgram = program;
+	ResetDecodeCache();
+}
 
-		default:
-			Log("Error (decode): Bad opcode (0x8000): " + opcode);
-		}
-		break;
+/* Maps translated blocks to their start addresses, if translated program was made from loaded ROM. */
+void Chip8::LoadTranslatedBlocks()
+{
+	if (translatedProgram == nullptr || ROM_START + translatedProgram->romSize > MEMORY_SIZE)
+		return;
 
-	case 0x9000: // Cond, if (Vx != Vy) skips nexts instruction
-		(V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4]) ? pc += 4 : UpdatePC();
-		Log("[9XY0] Cond, skips instr. if Vx != Vy");
-		break;
+	if (HashBytes(memory + ROM_START, translatedProgram->romSize) != translatedProgram->romHash)
+	{
+		LOG_WARNING("Warning (translated): Translated program doesn't match loaded ROM.");
+		return;
+	}
 
-	case 0xA000: // Mem, sets I to address NNN
-		I = opcode & 0x0FFF;
-		UpdatePC();
-		Log("[ANNN] MEM, I = NNN");
-		break;
+	for (unsigned int i = 0; i < translatedProgram->blockCount; ++i)
+	{
+		const TranslatedBlock& block = translatedProgram->blocks[i];
+		translatedBlocks[block.start] = &block;
 
-	case 0xB000: // Flow [0xBNNN], pc = v0 + NNN
-		pc = V[0] + (opcode & 0x0FFF);
-		Log("[BNNN] Flow, pc = V0 + NNN");
-		break;
+		for (unsigned int address = block.start; address < block.start + block.length * 2u && address < MEMORY_SIZE; ++address)
+			blockCode[address] = true;
+	}
+}
 
-	case 0xC000: // Rand [0xCxNN], Vx = rand() % 255 & NN
-		V[(opcode & 0x0F00) >> 8] = (rand() % 255) & (opcode & 0x00FF);
-		UpdatePC();
-		Log("[CXNN] Rand, Vx = rand() % 255 & NN");
-		break;
+/* Starts recording every executed instruction to tracer, nullptr stops recording. */
+void Chip8::SetTracer(Tracer* newTracer)
+{
+	tracer = newTracer;
+}
+
+/* Records state before instruction at pc is executed. */
+void Chip8::TraceCycle()
+{
+	TraceRecord record;
+	record.cycle      = cycleCount;
+	record.vDigest    = HashBytes(V, NUM_REGISTERS);
+	record.pc         = pc;
+	record.opcode     = FetchOpcode();
+	record.I          = I;
+	record.sp         = sp;
+	record.delayTimer = delayTimer;
+	record.reserved   = 0;
+
+	tracer->Record(record);
+}
+
+static_assert(std::is_trivially_copyable<MachineState>::value, "MachineState has to be copyable with memcpy");
+
+/* Copies whole machine state. */
+void Chip8::Snapshot(MachineState& state) const
+{
+	memcpy(&state, static_cast<const MachineState*>(this), sizeof(MachineState));
+}
+
+/* Puts machine to state taken by Snapshot. Decoded instructions and blocks are kept,
+ * only those covering memory which differs from state are dropped. */
+void Chip8::Restore(const MachineState& state)
+{
+	const int CHUNK = 64;
+	bool memoryChanged = (memcmp(memory, state.memory, MEMORY_SIZE) != 0);
+	for (int chunk = 0; memoryChanged && chunk < MEMORY_SIZE; chunk += CHUNK)
+	{
+		if (memcmp(memory + chunk, state.memory + chunk, CHUNK) == 0)
+			continue;
+
+		for (int address = chunk; address < chunk + CHUNK; ++address)
+			if (memory[address] != state.memory[address])
+				InvalidateCode(address);
+	}
+
+	memcpy(static_cast<MachineState*>(this), &state, sizeof(MachineState));
+
+	// State may come from run with different speed
+	timerPhase %= instructionsPerSecond;
+	drawFlag = true;
+	dirtyRows = ALL_ROWS;
+}
+
+/* Writes machine state to savestate file. File is raw MachineState, so it can be loaded
+ * only by build with the same STATE_VERSION and state layout. */
+bool Chip8::SaveState(const std::string& path) const
+{
+	std::ofstream stateFile(path, std::ios_base::binary);
+	if (!stateFile)
+	{
+		LOG_ERROR("Error saving state: Can't open " + path);
+		return false;
+	}
+
+	StateFileHeader header;
+	header.magic     = STATE_MAGIC;
+	header.version   = STATE_VERSION;
+	header.stateSize = sizeof(MachineState);
 
-	case 0xD000: // Disp, draw(Vx, Vy, N)
+	MachineState state;
+	Snapshot(state);
+
+	stateFile.write((const char*)&header, sizeof(header));
+	stateFile.write((const char*)&state, sizeof(state));
+	if (!stateFile)
+	{
+		LOG_ERROR("Error saving state: Can't write " + path);
+		return false;
+	}
+
+	LOG_INFO("State saved to " + path);
+	return true;
+}
+
+/* Loads machine state written by SaveState. */
+bool Chip8::LoadState(const std::string& path)
+{
+	std::ifstream stateFile(path, std::ios_base::binary);
+	if (!stateFile)
+	{
+		LOG_ERROR("Error loading state: Can't open " + path);
+		return false;
+	}
+
+	StateFileHeader header;
+	if (!stateFile.read((char*)&header, sizeof(header)) || header.magic != STATE_MAGIC)
+	{
+		LOG_ERROR("Error loading state: " + path + " is not a savestate file");
+		return false;
+	}
+
+	if (header.version != STATE_VERSION || header.stateSize != sizeof(MachineState))
+	{
+		LOG_ERROR("Error loading state: " + path + " was saved by incompatible version");
+		return false;
+	}
+
+	MachineState state;
+	if (!stateFile.read((char*)&state, sizeof(state)))
 	{
-		unsigned short x = V[(opcode & 0x0F00) >> 8];
-		unsigned short y = V[(opcode & 0x00F0) >> 4];
-		unsigned short height = opcode & 0x000F;
-		unsigned short pixel;
-		V[CARRY_FLAG] = 0; // CF is set to 1 when there was a change of pixel. It's mechanism for collision detection
+		LOG_ERROR("Error loading state: " + path + " is truncated");
+		return false;
+	}
+
+	Restore(state);
+
+	LOG_INFO("State loaded from " + path);
+	return true;
+}
+
+/* Sets colors of lit pixels and background. */
+void Chip8::SetPalette(const Palette& newPalette)
+{
+	palette = newPalette;
+}
+
+/* Sets size and filter of window image. Has to be set before MainLoop. */
+void Chip8::SetScaleOptions(const ScaleOptions& options)
+{
+	scaleOptions = options;
+}
+
+/* Picks when screen is published and presented. Has to be set before MainLoop. */
+void Chip8::SetPresentMode(PresentMode mode)
+{
+	presentMode = mode;
+}
+
+/* Counts every executed instruction to profiler, nullptr stops profiling. */
+void Chip8::SetProfiler(Profiler* newProfiler)
+{
+	profiler = newProfiler;
+}
+
+/* Records key changes and length of session run by MainLoop to movie, nullptr stops
+ * recording. Headless runs are recorded by caller, their input is known upfront. */
+void Chip8::SetMovie(Movie* recording)
+{
+	movie = recording;
+}
+
+/* Records screen of every 60 Hz frame to video, nullptr stops capturing. MainLoop captures
+ * frames itself, headless runs call CaptureFrame. */
+void Chip8::SetVideoCapture(VideoCapture* capture)
+{
+	videoCapture = capture;
+}
+
+/* Hands current screen to video capture. Headless runs have no frame deadline, so they
+ * wait for encoder instead of dropping frames. */
+void Chip8::CaptureFrame()
+{
+	if (videoCapture != nullptr)
+		videoCapture->AddFrame(gfx, true);
+}
+
+/* Seeds random numbers used by CXNN. Runs with the same seed and input are identical.
+ * Every Chip8 has its own generator, so parallel instances don't affect each other. */
+void Chip8::SetRandomSeed(unsigned int seed)
+{
+	randomSeed = seed;
+	random.Seed(seed);
+}
+
+unsigned int Chip8::RandomSeed() const
+{
+	return randomSeed;
+}
+
+/* Hash of current screen content, same screens give same hash. */
+unsigned int Chip8::FramebufferHash() const
+{
+	return HashBytes((const unsigned char*)gfx, sizeof(gfx));
+}
+
+/* Sets how many instructions emulated CPU executes per second of emulated time. */
+void Chip8::SetInstructionsPerSecond(unsigned int rate)
+{
+	instructionsPerSecond = (rate > TIMER_FREQUENCY) ? rate : TIMER_FREQUENCY;
+	timerPhase = 0;
+
+	// Compiled blocks have the rate built in
+	if (engine == ENGINE_JIT)
+		ResetDecodeCache();
+}
 
-		for (int i = 0; i < height; ++i)
+unsigned int Chip8::InstructionsPerSecond() const
+{
+	return instructionsPerSecond;
+}
+
+/* Number of cycles left until next timer tick, i.e. until the end of current 60 Hz frame. */
+unsigned int Chip8::CyclesUntilTimerTick() const
+{
+	return (instructionsPerSecond - timerPhase + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+}
+
+/* Emulates until the end of current 60 Hz frame of emulated time. */
+void Chip8::EmulateFrame()
+{
+	EmulateCycles(CyclesUntilTimerTick());
+}
+
+/* Number of cycles emulated since start. */
+unsigned long long Chip8::CycleCount() const
+{
+	return cycleCount;
+}
+
+/* Number of cycles which were skipped as idle instead of executed, included in CycleCount. */
+unsigned long long Chip8::IdleCyclesSkipped() const
+{
+	return idleCyclesSkipped;
+}
+
+/* Turns idle loop skipping on or off. Results are the same either way, off is for measuring
+ * the engines on every instruction a ROM runs. */
+void Chip8::SetIdleSkipping(bool enabled)
+{
+	idleSkipping = enabled;
+}
+
+/* FNV-1a hash of byte array. */
+unsigned int Chip8::HashBytes(const unsigned char* data, unsigned int size)
+{
+	unsigned int hash = 2166136261u;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Decodes Chip8 opcode. Picks handler for opcode and extracts all of it's operands. */
+Chip8::DecodedInstruction Chip8::Decode(unsigned short opcode)
+{
+	DecodedInstruction instr;
+	instr.opcode  = opcode;
+	instr.x       = (opcode & 0x0F00) >> 8;
+	instr.y       = (opcode & 0x00F0) >> 4;
+	instr.n       = opcode & 0x000F;
+	instr.nn      = opcode & 0x00FF;
+	instr.nnn     = opcode & 0x0FFF;
+	instr.handler = &Chip8::OpUnknown;
+
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+		switch (opcode & 0x000F)
 		{
-			pixel = memory[I + i];
-			for (int j = 0; j < 8; ++j)
-			{
-				// If pixel is activated
-				if ((pixel & (0x80 >> j)) != 0)
-				{
-					// Check for collision
-					if (gfx[x + j + (y + i) * SCREEN_WIDTH] == 1)
-						V[CARRY_FLAG] = 1;
-
-					// Activate/Deactivate pixel
-					gfx[x + j + (y + i) * SCREEN_WIDTH] ^= 1;
-				}
-			}
+		case 0x0000: instr.handler = &Chip8::Op00E0; break;
+		case 0x000E: instr.handler = &Chip8::Op00EE; break;
 		}
+		break;
 
-		drawFlag = true;
-		UpdatePC();
-		Log("[DXYN] Disp, draw(Vx, Vy, N)");
-	}
-	break;
+	case 0x1000: instr.handler = &Chip8::Op1NNN; break;
+	case 0x2000: instr.handler = &Chip8::Op2NNN; break;
+	case 0x3000: instr.handler = &Chip8::Op3XNN; break;
+	case 0x4000: instr.handler = &Chip8::Op4XNN; break;
+	case 0x5000: instr.handler = &Chip8::Op5XY0; break;
+	case 0x6000: instr.handler = &Chip8::Op6XNN; break;
+	case 0x7000: instr.handler = &Chip8::Op7XNN; break;
 
-	case 0xE000:
+	case 0x8000:
 		switch (opcode & 0x000F)
 		{
-		case 0x000E: // KeyOp, if (key() == Vx)
-			(key[V[(opcode & 0x0F00) >> 8]] != 0) ? pc += 4 : UpdatePC();
-			Log("[EX9E] KeyOp, skips instr. if key in Vx is pressed");
-			break;
+		case 0x0000: instr.handler = &Chip8::Op8XY0; break;
+		case 0x0001: instr.handler = &Chip8::Op8XY1; break;
+		case 0x0002: instr.handler = &Chip8::Op8XY2; break;
+		case 0x0003: instr.handler = &Chip8::Op8XY3; break;
+		case 0x0004: instr.handler = &Chip8::Op8XY4; break;
+		case 0x0005: instr.handler = &Chip8::Op8XY5; break;
+		case 0x0006: instr.handler = &Chip8::Op8XY6; break;
+		case 0x0007: instr.handler = &Chip8::Op8XY7; break;
+		case 0x000E: instr.handler = &Chip8::Op8XYE; break;
+		}
+		break;
 
-		case 0x0001: // KeyOp, if (key() != Vx)
-			(key[V[(opcode & 0x0F00) >> 8]] == 0) ? pc += 4 : UpdatePC();
-			Log("[EX9E] KeyOp, skips instr. if key in Vx isn't pressed");
-			break;
+	case 0x9000: instr.handler = &Chip8::Op9XY0; break;
+	case 0xA000: instr.handler = &Chip8::OpANNN; break;
+	case 0xB000: instr.handler = &Chip8::OpBNNN; break;
+	case 0xC000: instr.handler = &Chip8::OpCXNN; break;
+	case 0xD000: instr.handler = &Chip8::OpDXYN; break;
 
-		default:
-			Log("Error(decode) : Bad opcode(0xE000) : " + opcode);
+	case 0xE000:
+		switch (opcode & 0x000F)
+		{
+		case 0x000E: instr.handler = &Chip8::OpEX9E; break;
+		case 0x0001: instr.handler = &Chip8::OpEXA1; break;
 		}
 		break;
 
 	case 0xF000:
 		switch (opcode & 0x00FF)
 		{
-		case 0x0007: // Timer, Vx = get_delay()
-			V[(opcode & 0x0F00) >> 8] = delayTimer;
-			UpdatePC();
-			Log("[FX07] Timer, Vx = delayTimer");
-			break;
-
-		case 0x000A: // KeyOp, Vx = get_key()
-		{
-			bool keyPressed = false;
-
-			for (int i = 0; i < NUM_KEYS; ++i)
-			{
-				// Key is pressed
-				if (key[i] != 0)
-				{
-					V[(opcode & 0x0F00) >> 8] = i; // Set Vx to pressed key (i)
-					keyPressed = true;
-				}
-			}
-
-			// Go to next instruction only if key is pressed.
-			// Mechanism for waiting a key press is to not update program counter.
-			if (keyPressed)
-				UpdatePC();
-
-			Log("[FX0A] KeyOp, Wait for a key to be pressed");
+		case 0x0007: instr.handler = &Chip8::OpFX07; break;
+		case 0x000A: instr.handler = &Chip8::OpFX0A; break;
+		case 0x0015: instr.handler = &Chip8::OpFX15; break;
+		case 0x0018: instr.handler = &Chip8::OpFX18; break;
+		case 0x001E: instr.handler = &Chip8::OpFX1E; break;
+		case 0x0029: instr.handler = &Chip8::OpFX29; break;
+		case 0x0033: instr.handler = &Chip8::OpFX33; break;
+		case 0x0055: instr.handler = &Chip8::OpFX55; break;
+		case 0x0065: instr.handler = &Chip8::OpFX65; break;
 		}
 		break;
+	}
 
-		case 0x0015: // Timer, delay_timer(Vx)
-			delayTimer = V[(opcode & 0x0F00) >> 8];
-			UpdatePC();
-			Log("[FX15] Timer, delayTimer = Vx");
-			break;
+	return instr;
+}
 
-		case 0x0018: // Sound, sound_timer(Vx)
-			soundTimer = V[(opcode & 0x0F00) >> 8];
-			UpdatePC();
-			Log("[FX18] Sound, soundTimer = Vx");
-			break;
+/* Display, clears the screen */
+void Chip8::Op00E0(const DecodedInstruction&)
+{
+	for (int i = 0; i < SCREEN_HEIGHT; ++i)
+		gfx[i] = 0;
 
-		case 0x001E: // Mem, I += Vx
-			I += V[(opcode & 0x0F00) >> 8]; // @TODO: Check overflow ?!
-			UpdatePC();
-			Log("[FX1E] MEM, I += Vx");
-			break;
+	drawFlag = true;
+	dirtyRows = ALL_ROWS;
+	UpdatePC();
+	LOG_TRACE("[00E0] Display, clear the screen");
+}
 
-		case 0x0029: // Mem, I = sprite_addr[Vx]
-			I = V[(opcode & 0x0F00) >> 8] * 5;
-			UpdatePC();
-			Log("[FX29] MEM, Set I to te location of the sprite");
-			break;
+/* Flow, returns from subroutine */
+void Chip8::Op00EE(const DecodedInstruction&)
+{
+	--sp;
+	pc = stack[sp];
+	UpdatePC(); // @TODO: Correct ?!
+	LOG_TRACE("[00EE] Flow, return from subroutine");
+}
 
-		case 0x0033: // Bcd
-			memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-			memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-			memory[I + 2] = V[(opcode & 0x0F00) >> 8] % 10;
-			UpdatePC();
-			Log("[FX33] BCD");
-			break;
+/* Flow, goto NNN */
+void Chip8::Op1NNN(const DecodedInstruction& instr)
+{
+	pc = instr.nnn;
+	LOG_TRACE("[1NNN] Flow, jump to NNN");
+}
 
-		case 0x0055: // Mem, reg_dump(Vx, &I)
-			for (int i = 0; i <= (opcode & 0x0F00) >> 8; ++i)
-				memory[I++] = V[i];
+/* Flow, calls subroutine at NNN */
+void Chip8::Op2NNN(const DecodedInstruction& instr)
+{
+	stack[sp] = pc;
+	++sp;
+	pc = instr.nnn;
+	LOG_TRACE("[2NNN] Flow, calls subroutine at NNN");
+}
 
-			UpdatePC();
-			Log("[FX55] MEM, reg_dump(Vx, &I)");
-			break;
+/* Cond, if (Vx == NN), skips 1 instruction */
+void Chip8::Op3XNN(const DecodedInstruction& instr)
+{
+	pc += (V[instr.x] == instr.nn) ? 4 : 2;
+	LOG_TRACE("[3XNN] Cond, skips instr. if VX==NN");
+}
 
-		case 0x0065: // Mem, reg_load(Vx, &I)
-			for (int i = 0; i <= (opcode & 0x0F00) >> 8; ++i)
-				V[i] = memory[I++];
+/* Cond, if (Vx != NN), skips 1 instruction */
+void Chip8::Op4XNN(const DecodedInstruction& instr)
+{
+	pc += (V[instr.x] != instr.nn) ? 4 : 2;
+	LOG_TRACE("[4XNN] Cond, skips instr. if VX!=NN");
+}
 
-			UpdatePC();
-			Log("[FX65] MEM, reg_load(Vx, &I)");
-			break;
+/* Cond, if (Vx == Vy), skips 1 instruction */
+void Chip8::Op5XY0(const DecodedInstruction& instr)
+{
+	pc += (V[instr.x] == V[instr.y]) ? 4 : 2;
+	LOG_TRACE("[5XY0] Cond, skips instr. if VX==VY");
+}
 
-		default:
-			Log("Error (decode): Bad opcode (0xF000): " + opcode);
+/* Const, sets Vx to NN */
+void Chip8::Op6XNN(const DecodedInstruction& instr)
+{
+	V[instr.x] = instr.nn;
+	LOG_TRACE("[6XNN] Const, set Vx = NN");
+	UpdatePC();
+}
+
+/* Const, adds NN to Vx */
+void Chip8::Op7XNN(const DecodedInstruction& instr)
+{
+	V[instr.x] += instr.nn;
+	LOG_TRACE("[7XNN] Const, Vx += NN");
+	UpdatePC();
+}
+
+/* Assign, Vx = Vy */
+void Chip8::Op8XY0(const DecodedInstruction& instr)
+{
+	V[instr.x] = V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY0] Assign, Vx = Vy");
+}
+
+/* BitOp, Vx = Vx | Vy */
+void Chip8::Op8XY1(const DecodedInstruction& instr)
+{
+	V[instr.x] |= V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY1] BitOp, Vx = Vx | Vy");
+}
+
+/* BitOp, Vx = Vx & Vy */
+void Chip8::Op8XY2(const DecodedInstruction& instr)
+{
+	V[instr.x] &= V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY2] BitOp, Vx = Vx & Vy");
+}
+
+/* BitOp, Vx = Vx ^ Vy */
+void Chip8::Op8XY3(const DecodedInstruction& instr)
+{
+	V[instr.x] ^= V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY3] BitOp, Vx = Vx ^ Vy");
+}
+
+/* Math, Vx += Vy */
+void Chip8::Op8XY4(const DecodedInstruction& instr)
+{
+	if (V[instr.y] > 0xFF - V[instr.x])
+		V[CARRY_FLAG] = 1;
+	else
+		V[CARRY_FLAG] = 0;
+
+	V[instr.x] += V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY4] Math, Vx += Vy w/CF");
+}
+
+/* Math, Vx -= Vy */
+void Chip8::Op8XY5(const DecodedInstruction& instr)
+{
+	if (V[instr.x] < V[instr.y])
+		V[CARRY_FLAG] = 0;
+	else
+		V[CARRY_FLAG] = 1;
+
+	V[instr.x] -= V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY5] Math, Vx -= Vy w/CF");
+}
+
+/* BitOp, Shift Vy>>1 and copy result to Vx. Set VF to least sig.bit of VY before shift */
+void Chip8::Op8XY6(const DecodedInstruction& instr)
+{
+	V[CARRY_FLAG] = V[instr.y] & 0b00000001; // @TODO: Correct ?!!
+	V[instr.y] >>= 1;
+	V[instr.x] = V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XY6] BitOp, Vx=Vy=Vy>>1");
+}
+
+/* Math, Vx = Vy - Vx */
+void Chip8::Op8XY7(const DecodedInstruction& instr)
+{
+	if (V[instr.x] > V[instr.y])
+		V[CARRY_FLAG] = 0;
+	else
+		V[CARRY_FLAG] = 1;
+
+	V[instr.x] = V[instr.y] - V[instr.x];
+	UpdatePC();
+	LOG_TRACE("[8XY7] Math, Vx = Vy - Vx");
+}
+
+/* BitOp, Vx=Vy=Vy<<1 */
+void Chip8::Op8XYE(const DecodedInstruction& instr)
+{
+	V[CARRY_FLAG] = V[instr.y] & 0b00000001; // @TODO: Correct ?!!
+	V[instr.y] <<= 1;
+	V[instr.x] = V[instr.y];
+	UpdatePC();
+	LOG_TRACE("[8XYE] BitOp, Vx=Vy=Vy<<1");
+}
+
+/* Cond, if (Vx != Vy) skips nexts instruction */
+void Chip8::Op9XY0(const DecodedInstruction& instr)
+{
+	pc += (V[instr.x] != V[instr.y]) ? 4 : 2;
+	LOG_TRACE("[9XY0] Cond, skips instr. if Vx != Vy");
+}
+
+/* Mem, sets I to address NNN */
+void Chip8::OpANNN(const DecodedInstruction& instr)
+{
+	I = instr.nnn;
+	UpdatePC();
+	LOG_TRACE("[ANNN] MEM, I = NNN");
+}
+
+/* Flow, pc = v0 + NNN */
+void Chip8::OpBNNN(const DecodedInstruction& instr)
+{
+	pc = (V[0] + instr.nnn) & 0x0FFF; // Stay inside 4K address space
+	LOG_TRACE("[BNNN] Flow, pc = V0 + NNN");
+}
+
+/* Rand, Vx = random % 255 & NN */
+void Chip8::OpCXNN(const DecodedInstruction& instr)
+{
+	V[instr.x] = (random.Next() % 255) & instr.nn;
+	UpdatePC();
+	LOG_TRACE("[CXNN] Rand, Vx = random % 255 & NN");
+}
+
+/* Disp, draw(Vx, Vy, N) */
+void Chip8::OpDXYN(const DecodedInstruction& instr)
+{
+	DrawSprite(V[instr.x], V[instr.y], instr.n);
+	UpdatePC();
+	LOG_TRACE("[DXYN] Disp, draw(Vx, Vy, N)");
+}
+
+/* KeyOp, if (key() == Vx) */
+void Chip8::OpEX9E(const DecodedInstruction& instr)
+{
+	pc += (key[V[instr.x]] != 0) ? 4 : 2;
+	LOG_TRACE("[EX9E] KeyOp, skips instr. if key in Vx is pressed");
+}
+
+/* KeyOp, if (key() != Vx) */
+void Chip8::OpEXA1(const DecodedInstruction& instr)
+{
+	pc += (key[V[instr.x]] == 0) ? 4 : 2;
+	LOG_TRACE("[EXA1] KeyOp, skips instr. if key in Vx isn't pressed");
+}
+
+/* Timer, Vx = get_delay() */
+void Chip8::OpFX07(const DecodedInstruction& instr)
+{
+	V[instr.x] = delayTimer;
+	UpdatePC();
+	LOG_TRACE("[FX07] Timer, Vx = delayTimer");
+}
+
+/* KeyOp, Vx = get_key() */
+void Chip8::OpFX0A(const DecodedInstruction& instr)
+{
+	bool keyPressed = false;
+
+	for (int i = 0; i < NUM_KEYS; ++i)
+	{
+		// Key is pressed
+		if (key[i] != 0)
+		{
+			V[instr.x] = i; // Set Vx to pressed key (i)
+			keyPressed = true;
 		}
-		break;
+	}
 
-	default:
-		Log("Error (Decode): Unknown opcode " + opcode);
+	// Go to next instruction only if key is pressed.
+	// Mechanism for waiting a key press is to not update program counter.
+	if (keyPressed)
+		UpdatePC();
+
+	LOG_TRACE("[FX0A] KeyOp, Wait for a key to be pressed");
+}
+
+/* Timer, delay_timer(Vx) */
+void Chip8::OpFX15(const DecodedInstruction& instr)
+{
+	delayTimer = V[instr.x];
+	UpdatePC();
+	LOG_TRACE("[FX15] Timer, delayTimer = Vx");
+}
+
+/* Sound, sound_timer(Vx) */
+void Chip8::OpFX18(const DecodedInstruction& instr)
+{
+	soundTimer = V[instr.x];
+	UpdatePC();
+	LOG_TRACE("[FX18] Sound, soundTimer = Vx");
+}
+
+/* Mem, I += Vx */
+void Chip8::OpFX1E(const DecodedInstruction& instr)
+{
+	I += V[instr.x]; // @TODO: Check overflow ?!
+	UpdatePC();
+	LOG_TRACE("[FX1E] MEM, I += Vx");
+}
+
+/* Mem, I = sprite_addr[Vx] */
+void Chip8::OpFX29(const DecodedInstruction& instr)
+{
+	I = V[instr.x] * 5;
+	UpdatePC();
+	LOG_TRACE("[FX29] MEM, Set I to te location of the sprite");
+}
+
+/* Bcd */
+void Chip8::OpFX33(const DecodedInstruction& instr)
+{
+	WriteMemory(I, V[instr.x] / 100);
+	WriteMemory(I + 1, (V[instr.x] / 10) % 10);
+	WriteMemory(I + 2, V[instr.x] % 10);
+	UpdatePC();
+	LOG_TRACE("[FX33] BCD");
+}
+
+/* Mem, reg_dump(Vx, &I) */
+void Chip8::OpFX55(const DecodedInstruction& instr)
+{
+	for (int i = 0; i <= instr.x; ++i)
+		WriteMemory(I++, V[i]);
+
+	UpdatePC();
+	LOG_TRACE("[FX55] MEM, reg_dump(Vx, &I)");
+}
+
+/* Mem, reg_load(Vx, &I) */
+void Chip8::OpFX65(const DecodedInstruction& instr)
+{
+	for (int i = 0; i <= instr.x; ++i)
+		V[i] = memory[I++];
+
+	UpdatePC();
+	LOG_TRACE("[FX65] MEM, reg_load(Vx, &I)");
+}
+
+/* Opcode which doesn't match any instruction. Program counter is not updated. */
+void Chip8::OpUnknown(const DecodedInstruction& instr)
+{
+	LOG_ERROR("Error (decode): Unknown opcode " + ToHex(instr.opcode));
+}
+
+/* XORs N bytes high sprite from memory location I onto screen at (x, y).
+ * VF is set when any pixel is turned off, it's mechanism for collision detection.
+ * Start position wraps around the screen, parts of sprite past the right or bottom edge are clipped. */
+void Chip8::DrawSprite(unsigned char x, unsigned char y, unsigned char height)
+{
+	x %= SCREEN_WIDTH;
+	y %= SCREEN_HEIGHT;
+	V[CARRY_FLAG] = 0;
+
+	// Sprite is clipped at bottom edge, rows below it stay clean
+	int rowCount = (y + height < SCREEN_HEIGHT) ? height : SCREEN_HEIGHT - y;
+	dirtyRows |= (uint32_t)(((1ull << rowCount) - 1) << y);
+
+	for (int i = 0; i < rowCount; ++i)
+	{
+		// Sprite byte moved to column x of the row, bits past the right edge fall off
+		uint64_t spriteRow = (uint64_t)memory[(I + i) & (MEMORY_SIZE - 1)] << (SCREEN_WIDTH - 8) >> x;
+
+		// Check for collision
+		if ((gfx[y + i] & spriteRow) != 0)
+			V[CARRY_FLAG] = 1;
+
+		// Activate/Deactivate pixels
+		gfx[y + i] ^= spriteRow;
 	}
+
+	drawFlag = true;
+}
+
+/* Writes byte to memory. Every write which can hit program code has to go through here,
+ * so that stale instructions are dropped from decode cache. */
+void Chip8::WriteMemory(unsigned short address, unsigned char value)
+{
+	address &= MEMORY_SIZE - 1;
+	memory[address] = value;
+
+	InvalidateCode(address);
+}
+
+/* Drops decoded instructions and blocks which contain byte at address. */
+void Chip8::InvalidateCode(unsigned short address)
+{
+	// Byte is part of instruction starting at address and of the one starting a byte before
+	decodeCache[address].handler = nullptr;
+	if (address > 0)
+		decodeCache[address - 1].handler = nullptr;
+
+	// Most writes go to data, only bytes which some block covered need the scan below
+	if (!blockCode[address])
+		return;
+
+	// Drop every block which covers written byte
+	int first = address - MAX_BLOCK_LENGTH * 2 + 1;
+	for (int start = (first > 0) ? first : 0; start <= address; ++start)
+	{
+		if (start + blockLength[start] * 2 > address)
+			blockLength[start] = 0;
+
+		if (translatedBlocks[start] != nullptr && start + translatedBlocks[start]->length * 2 > address)
+			translatedBlocks[start] = nullptr;
+	}
+}
+
+/* Drops all decoded instructions and blocks. Used when whole memory is (re)loaded. */
+void Chip8::ResetDecodeCache()
+{
+	for (int i = 0; i < MEMORY_SIZE; ++i)
+	{
+		decodeCache[i].handler = nullptr;
+		blockLength[i] = 0;
+		translatedBlocks[i] = nullptr;
+		blockCode[i] = false;
+	}
+
+	if (engine == ENGINE_TRANSLATED)
+		LoadTranslatedBlocks();
 }
 
 /* Get next opcode from memory. Opcodes are stored as Big-endian. */
@@ -565,9 +1575,19 @@ unsigned short Chip8::FetchOpcode()
 	return highByte << 8 | lowByte;
 }
 
-/* Decreasing timers until they reach 0. */
+/* Called once after every emulated cycle. Timers are decreased (until they reach 0) at
+ * TIMER_FREQUENCY of emulated time, so they don't depend on how fast host runs the CPU. */
 void Chip8::UpdateTimers()
 {
+	++cycleCount;
+
+	// Exactly TIMER_FREQUENCY ticks in every instructionsPerSecond cycles
+	timerPhase += TIMER_FREQUENCY;
+	if (timerPhase < instructionsPerSecond)
+		return;
+
+	timerPhase -= instructionsPerSecond;
+
 	if (delayTimer > 0)
 		--delayTimer;
 	
@@ -579,10 +1599,4 @@ void Chip8::UpdateTimers()
 void Chip8::UpdatePC()
 {
 	pc += 2;
-}
-
-/* Logs message to console. */
-void Log(const std::string& message)
-{
-	std::cout << message << std::endl;
 }
\ No newline at end of file
@@ -1,59 +1,314 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include "SFML/Graphics.hpp"
+#include "PixelConverter.h"
+#include "Random.h"
+#include "SpscRing.h"
+#include "Tracer.h"
+#include "TripleBuffer.h"
+#include "Upscaler.h"
 
 #define MEMORY_SIZE   4096
 #define NUM_REGISTERS 16
 #define SCREEN_WIDTH  64
 #define SCREEN_HEIGHT 32
-#define MULTIPLIER    10
 #define STACK_SIZE    16
 #define NUM_KEYS      16
 #define FONTSET_SIZE  80
 #define NUM_PIXELS    SCREEN_WIDTH * SCREEN_HEIGHT
+#define DISPATCH_TABLE_SIZE 0x10000
+#define MAX_BLOCK_LENGTH 32
+#define ROM_START     0x200
+#define TIMER_FREQUENCY 60								// delay and sound timer tick rate, in Hz of emulated time
+#define DEFAULT_INSTRUCTIONS_PER_SECOND 600
+#define PIXEL_MASK    0x8000000000000000ull				// leftmost pixel of packed screen row
+#define ALL_ROWS      0xFFFFFFFFu						// dirty row mask with every screen row set
+#define INPUT_QUEUE_SIZE 64								// key events waiting for emulation thread
+#define EVENT_POLL_INTERVAL 8							// ms window thread waits for new screen before it handles events again
+#define STATE_MAGIC   0x54533843						// "C8ST"
+#define STATE_VERSION 2
 
-class Chip8
+class Chip8;
+class JitCompiler;
+class Profiler;
+class RewindBuffer;
+class VideoCapture;
+struct Movie;
+
+// Basic block translated ahead of time by CHIP-8_Translator
+struct TranslatedBlock
+{
+	unsigned short start;								// address of first instruction
+	unsigned short length;								// number of instructions
+	void (*run)(Chip8& chip);
+};
+
+// All translated blocks of one ROM, valid only while that ROM is loaded
+struct TranslatedProgram
+{
+	unsigned int romSize;
+	unsigned int romHash;								// Chip8::HashBytes of ROM
+	const TranslatedBlock* blocks;
+	unsigned int blockCount;
+};
+
+// Everything that changes while emulated program runs. Plain data, so whole machine is
+// saved and restored with one copy, see Chip8::Snapshot and Chip8::Restore
+struct MachineState
+{
+	// Data storage
+	uint64_t gfx[SCREEN_HEIGHT];						// screen, one bit per pixel, leftmost pixel in highest bit
+	unsigned char memory[MEMORY_SIZE];					// 4K memory
+	unsigned short stack[STACK_SIZE];					// stack for jump instructions and function calls
+	unsigned char key[NUM_KEYS];						// keyboard state
+
+	// Registers
+	unsigned char V[NUM_REGISTERS];						// registers
+	unsigned short I;									// index register
+	unsigned short pc;									// program counter register
+	unsigned short opcode;								// current opcode
+	unsigned char sp;									// stack pointer
+
+	// Timers
+	unsigned char delayTimer;
+	unsigned char soundTimer;
+	unsigned int timerPhase;							// grows by TIMER_FREQUENCY every cycle, timers tick when it reaches instructionsPerSecond
+	unsigned long long cycleCount;						// cycles emulated since start
+	XorShiftRandom random;								// used by CXNN, seeded by Chip8::SetRandomSeed
+};
+
+// Written at the start of savestate file, followed by MachineState
+struct StateFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int stateSize;
+};
+
+// Finished screen passed from emulation thread to window thread
+struct ScreenFrame
+{
+	uint64_t gfx[SCREEN_HEIGHT];
+};
+
+enum InputEventType
 {
+	INPUT_KEY,
+	INPUT_SAVE_STATE,
+	INPUT_LOAD_STATE,
+	INPUT_REWIND										// state 1 starts stepping back frame by frame, 0 stops
+};
+
+// Key change or command passed from window thread to emulation thread
+struct InputEvent
+{
+	unsigned char type;									// InputEventType
+	unsigned char key;									// Chip8 key 0 - F
+	unsigned char state;								// 1 pressed, 0 released
+};
+
+class Chip8 : private MachineState
+{
+	friend struct Chip8Translated;						// generated code works directly on Chip8 state
+	friend struct Chip8Benchmark;						// micro benchmarks set up state and call handlers directly
+	friend struct Chip8Specialized;						// handlers of dispatch table, see DispatchTable.cpp
+	friend class JitCompiler;							// compiles blocks from decode cache to code working on machine state
+
 public:
+	struct DecodedInstruction;
+	typedef void (Chip8::*OpcodeHandler)(const DecodedInstruction& instr);
+	typedef void (*SpecializedHandler)(Chip8& chip, unsigned int opcode);	// handler instantiated for registers of one opcode
+
+	// Instruction with handler and operands already extracted from opcode
+	struct DecodedInstruction
+	{
+		OpcodeHandler handler;							// nullptr if not decoded yet
+		unsigned short opcode;
+		unsigned short nnn;
+		unsigned char x;
+		unsigned char y;
+		unsigned char n;
+		unsigned char nn;
+	};
+
+	enum InterpreterEngine
+	{
+		ENGINE_DECODE_CACHE,							// decode once per address, see decodeCache
+		ENGINE_DISPATCH_TABLE,							// call handler specialized for fetched opcode from DispatchTable()
+		ENGINE_BLOCK_CACHE,								// run whole basic blocks from decode cache, see EmulateCycles
+		ENGINE_TRANSLATED,								// run blocks of ROM translated ahead of time, see SetTranslatedProgram
+		ENGINE_JIT										// run blocks compiled to native code at runtime, see JitCompiler
+	};
+
+	// When screen is handed to window and when window shows it, see MainLoop and EmulationLoop
+	enum PresentMode
+	{
+		PRESENT_IMMEDIATE,								// publish after every drawing instruction, half drawn scenes are shown too
+		PRESENT_FRAME,									// publish once per emulated 60 Hz frame, window presents it right away
+		PRESENT_VBLANK									// publish once per frame, window presents each new screen at monitor vblank
+	};
+
 	Chip8();
 	~Chip8();
 
 	void MainLoop();
 	void EmulateCycle();
+	void EmulateCycles(unsigned int count);
+	void EmulateFrame();
 	bool LoadROM(const std::string& romPath);
-	void Render(sf::RenderWindow& window);
+	void Render(sf::RenderWindow& window, const ScreenFrame& frame, uint32_t rows);
 	void HandleEvents(sf::RenderWindow& window);
 	void Chip8::SwitchKeyState(sf::Keyboard::Key pressedKey, int state);
+	void SetKey(unsigned char chip8Key, int state);
 
 	unsigned short FetchOpcode();
 	void DecodeExecute();
 	void UpdateTimers();
 	void UpdatePC();
+	void SetEngine(InterpreterEngine newEngine);
+	void SetTranslatedProgram(const TranslatedProgram* program);
+	void SetTracer(Tracer* newTracer);
+	void SetProfiler(Profiler* newProfiler);
+	void SetPalette(const Palette& newPalette);
+	void SetPresentMode(PresentMode mode);
+	void SetScaleOptions(const ScaleOptions& options);
+	void SetMovie(Movie* recording);
+	void SetVideoCapture(VideoCapture* capture);
+	void CaptureFrame();
+	void SetRandomSeed(unsigned int seed);
+	unsigned int RandomSeed() const;
+
+	void Snapshot(MachineState& state) const;
+	void Restore(const MachineState& state);
+	bool SaveState(const std::string& path) const;
+	bool LoadState(const std::string& path);
+
+	unsigned int FramebufferHash() const;
+	unsigned long long CycleCount() const;
+	unsigned long long IdleCyclesSkipped() const;
+	void SetIdleSkipping(bool enabled);
+	void SetInstructionsPerSecond(unsigned int rate);
+	unsigned int InstructionsPerSecond() const;
+	unsigned int CyclesUntilTimerTick() const;
+
+	static unsigned int HashBytes(const unsigned char* data, unsigned int size);
 
 private:
+	static DecodedInstruction Decode(unsigned short opcode);
+	static const SpecializedHandler* DispatchTable();
+	static bool EndsBlock(OpcodeHandler handler);
+	unsigned int BuildBlock(unsigned short start);
+	void ExecuteBlock(unsigned short start, unsigned int length);
+	void LoadTranslatedBlocks();
+	void TraceCycle();
+	void InstrumentedCycle();
+	void EmulationLoop();
+	void EmulateFrameImmediate();
+	void PublishFrame();
+	void WaitForScreen();
+	void QueueKey(unsigned char chip8Key, int state);
+	void QueueCommand(InputEventType type, unsigned char state = 0);
+	void RecordRewindFrame();
+	void RewindFrame();
+	void ApplyInput(const InputEvent& event);
+	unsigned int ExecuteNext(unsigned int count);
+	unsigned int SkipIdleLoop(unsigned int count);
+	void SkipCycles(unsigned int count);
+	void DrawSprite(unsigned char x, unsigned char y, unsigned char height);
+	void WriteMemory(unsigned short address, unsigned char value);
+	void InvalidateCode(unsigned short address);
+	void UpdateScreenImage(const ScreenFrame& frame);
+	void UploadRows(int firstRow, int rowCount);
+	void SaveScreenshot();
+	void ResetDecodeCache();
+
+	// Opcode handlers
+	void Op00E0(const DecodedInstruction& instr);
+	void Op00EE(const DecodedInstruction& instr);
+	void Op1NNN(const DecodedInstruction& instr);
+	void Op2NNN(const DecodedInstruction& instr);
+	void Op3XNN(const DecodedInstruction& instr);
+	void Op4XNN(const DecodedInstruction& instr);
+	void Op5XY0(const DecodedInstruction& instr);
+	void Op6XNN(const DecodedInstruction& instr);
+	void Op7XNN(const DecodedInstruction& instr);
+	void Op8XY0(const DecodedInstruction& instr);
+	void Op8XY1(const DecodedInstruction& instr);
+	void Op8XY2(const DecodedInstruction& instr);
+	void Op8XY3(const DecodedInstruction& instr);
+	void Op8XY4(const DecodedInstruction& instr);
+	void Op8XY5(const DecodedInstruction& instr);
+	void Op8XY6(const DecodedInstruction& instr);
+	void Op8XY7(const DecodedInstruction& instr);
+	void Op8XYE(const DecodedInstruction& instr);
+	void Op9XY0(const DecodedInstruction& instr);
+	void OpANNN(const DecodedInstruction& instr);
+	void OpBNNN(const DecodedInstruction& instr);
+	void OpCXNN(const DecodedInstruction& instr);
+	void OpDXYN(const DecodedInstruction& instr);
+	void OpEX9E(const DecodedInstruction& instr);
+	void OpEXA1(const DecodedInstruction& instr);
+	void OpFX07(const DecodedInstruction& instr);
+	void OpFX0A(const DecodedInstruction& instr);
+	void OpFX15(const DecodedInstruction& instr);
+	void OpFX18(const DecodedInstruction& instr);
+	void OpFX1E(const DecodedInstruction& instr);
+	void OpFX29(const DecodedInstruction& instr);
+	void OpFX33(const DecodedInstruction& instr);
+	void OpFX55(const DecodedInstruction& instr);
+	void OpFX65(const DecodedInstruction& instr);
+	void OpUnknown(const DecodedInstruction& instr);
 
 	bool drawFlag;
+	uint32_t dirtyRows;									// rows drawn since last PublishFrame, bit y is row y
+	InterpreterEngine engine;
+	const SpecializedHandler* dispatchTable;			// set only for ENGINE_DISPATCH_TABLE
+	const TranslatedProgram* translatedProgram;
+	std::unique_ptr<JitCompiler> jit;					// created when ENGINE_JIT is selected
+	std::string statePath;								// savestate file for F5 / F9, next to loaded ROM
+	std::string screenshotPrefix;						// F12 saves <prefix>_<n>.png
+	unsigned int screenshotCount;
+	Tracer* tracer;										// nullptr if tracing is off
+	Profiler* profiler;									// nullptr if profiling is off
+	Movie* movie;										// movie being recorded in MainLoop, nullptr if not recording
+	VideoCapture* videoCapture;							// nullptr if not capturing
+	unsigned int randomSeed;
+	unsigned long long idleCyclesSkipped;				// part of cycleCount elided by SkipIdleLoop
+	bool idleSkipping;									// false runs idle loops instruction by instruction
+	unsigned int instructionsPerSecond;					// emulated CPU speed
 	static const unsigned char fontset[FONTSET_SIZE];
 	const int CARRY_FLAG = NUM_REGISTERS - 1;
-	sf::Uint8 screenImage[NUM_PIXELS * 4];				// contains RGBA values
+	ScaleOptions scaleOptions;							// size and filter of window image
+	Palette palette;
+	PresentMode presentMode;
 
-	// Registers
-	unsigned char sp;									// stack pointer
-	unsigned char V[NUM_REGISTERS];						// registers
-	unsigned short I;									// index register
-	unsigned short pc;									// program counter register
-	unsigned short opcode;								// current opcode
-	
-	// Timers
-	unsigned char delayTimer;
-	unsigned char soundTimer;
+	// Created only while window is open, texture needs OpenGL context which headless runs don't have
+	std::unique_ptr<Upscaler> upscaler;					// RGBA screen at window size, contains last uploaded screen
+	std::unique_ptr<sf::Texture> screenTexture;
+	sf::Sprite screenSprite;
+	uint64_t uploadedGfx[SCREEN_HEIGHT];				// screen content currently in texture
+	bool screenUploaded;
 
-	// Data storage
-	unsigned char gfx[NUM_PIXELS];	                    // screen
-	unsigned char key[NUM_KEYS];						// keyboard state
-	unsigned char memory[MEMORY_SIZE];					// 4K memory
-	unsigned short stack[STACK_SIZE];					// stack for jump instructions and function calls
-};
+	// Shared between window thread (MainLoop) and emulation thread (EmulationLoop)
+	std::atomic<bool> emulationRunning;
+	TripleBuffer<ScreenFrame> frames;
+	std::atomic<uint32_t> pendingRows;					// dirty rows of published frames window thread hasn't uploaded yet
+	std::mutex screenMutex;								// only orders PublishFrame against WaitForScreen going to sleep
+	std::condition_variable screenPublished;			// signalled when pendingRows gets new rows
+	SpscRing<InputEvent, INPUT_QUEUE_SIZE> inputQueue;
+
+	// Used only by emulation thread, history exists only while window is open
+	std::unique_ptr<RewindBuffer> rewindBuffer;
+	bool rewinding;
 
-void Log(const std::string& message);
\ No newline at end of file
+	DecodedInstruction decodeCache[MEMORY_SIZE];		// decoded instruction for every address, see WriteMemory
+	unsigned char blockLength[MEMORY_SIZE];				// instructions in block starting at address, 0 if not built
+	const TranslatedBlock* translatedBlocks[MEMORY_SIZE];	// translated block starting at address, if any
+	bool blockCode[MEMORY_SIZE];						// byte was part of some block since ResetDecodeCache, see InvalidateCode
+};
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "Disassembler.h"
+#include <cstdio>
+
+/* Returns assembly mnemonic for Chip8 opcode, e.g. "LD V1, 0x0A". Unknown opcodes are shown as data. */
+std::string Disassemble(unsigned short opcode)
+{
+	unsigned int x   = (opcode & 0x0F00) >> 8;
+	unsigned int y   = (opcode & 0x00F0) >> 4;
+	unsigned int n   = opcode & 0x000F;
+	unsigned int nn  = opcode & 0x00FF;
+	unsigned int nnn = opcode & 0x0FFF;
+
+	char text[32];
+	snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+		if (n == 0x0) snprintf(text, sizeof(text), "CLS");
+		if (n == 0xE) snprintf(text, sizeof(text), "RET");
+		break;
+
+	case 0x1000: snprintf(text, sizeof(text), "JP 0x%03X", nnn); break;
+	case 0x2000: snprintf(text, sizeof(text), "CALL 0x%03X", nnn); break;
+	case 0x3000: snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, nn); break;
+	case 0x4000: snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, nn); break;
+	case 0x5000: snprintf(text, sizeof(text), "SE V%X, V%X", x, y); break;
+	case 0x6000: snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, nn); break;
+	case 0x7000: snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, nn); break;
+
+	case 0x8000:
+		switch (n)
+		{
+		case 0x0: snprintf(text, sizeof(text), "LD V%X, V%X", x, y); break;
+		case 0x1: snprintf(text, sizeof(text), "OR V%X, V%X", x, y); break;
+		case 0x2: snprintf(text, sizeof(text), "AND V%X, V%X", x, y); break;
+		case 0x3: snprintf(text, sizeof(text), "XOR V%X, V%X", x, y); break;
+		case 0x4: snprintf(text, sizeof(text), "ADD V%X, V%X", x, y); break;
+		case 0x5: snprintf(text, sizeof(text), "SUB V%X, V%X", x, y); break;
+		case 0x6: snprintf(text, sizeof(text), "SHR V%X, V%X", x, y); break;
+		case 0x7: snprintf(text, sizeof(text), "SUBN V%X, V%X", x, y); break;
+		case 0xE: snprintf(text, sizeof(text), "SHL V%X, V%X", x, y); break;
+		}
+		break;
+
+	case 0x9000: snprintf(text, sizeof(text), "SNE V%X, V%X", x, y); break;
+	case 0xA000: snprintf(text, sizeof(text), "LD I, 0x%03X", nnn); break;
+	case 0xB000: snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn); break;
+	case 0xC000: snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, nn); break;
+	case 0xD000: snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n); break;
+
+	case 0xE000:
+		if (n == 0xE) snprintf(text, sizeof(text), "SKP V%X", x);
+		if (n == 0x1) snprintf(text, sizeof(text), "SKNP V%X", x);
+		break;
+
+	case 0xF000:
+		switch (nn)
+		{
+		case 0x07: snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+		case 0x0A: snprintf(text, sizeof(text), "LD V%X, K", x); break;
+		case 0x15: snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+		case 0x18: snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+		case 0x1E: snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+		case 0x29: snprintf(text, sizeof(text), "LD F, V%X", x); break;
+		case 0x33: snprintf(text, sizeof(text), "LD B, V%X", x); break;
+		case 0x55: snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+		case 0x65: snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+		}
+		break;
+	}
+
+	return text;
+}
+
+/* Returns opcode pattern which selects instruction handler, e.g. "8XY4" for 0x8AB4. Opcodes without
+ * handler are "????". Same split as Chip8::Decode, used to group opcodes in profiles. */
+std::string OpcodeClass(unsigned short opcode)
+{
+	char text[8];
+	snprintf(text, sizeof(text), "????");
+
+	unsigned int group = (opcode & 0xF000) >> 12;
+	unsigned int n     = opcode & 0x000F;
+	unsigned int nn    = opcode & 0x00FF;
+
+	switch (group)
+	{
+	case 0x0:
+		if (n == 0x0) snprintf(text, sizeof(text), "00E0");
+		if (n == 0xE) snprintf(text, sizeof(text), "00EE");
+		break;
+
+	case 0x1: case 0x2: case 0xA: case 0xB:
+		snprintf(text, sizeof(text), "%XNNN", group);
+		break;
+
+	case 0x3: case 0x4: case 0x6: case 0x7: case 0xC:
+		snprintf(text, sizeof(text), "%XXNN", group);
+		break;
+
+	case 0x5: case 0x9:
+		snprintf(text, sizeof(text), "%XXY0", group);
+		break;
+
+	case 0x8:
+		if (n <= 0x7 || n == 0xE) snprintf(text, sizeof(text), "8XY%X", n);
+		break;
+
+	case 0xD:
+		snprintf(text, sizeof(text), "DXYN");
+		break;
+
+	case 0xE:
+		if (n == 0xE) snprintf(text, sizeof(text), "EX9E");
+		if (n == 0x1) snprintf(text, sizeof(text), "EXA1");
+		break;
+
+	case 0xF:
+		switch (nn)
+		{
+		case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x33: case 0x55: case 0x65:
+			snprintf(text, sizeof(text), "FX%02X", nn);
+			break;
+		}
+		break;
+	}
+
+	return text;
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+std::string Disassemble(unsigned short opcode);
+std::string OpcodeClass(unsigned short opcode);
\ No newline at end of file
@@ -0,0 +1,383 @@
+#include "Cpu.h"
+#include "Log.h"
+#include <utility>
+
+#define OPCODE_X(opcode) (((opcode) >> 8) & 0xF)
+#define OPCODE_Y(opcode) (((opcode) >> 4) & 0xF)
+
+/* Handlers of ENGINE_DISPATCH_TABLE, they do the same as Chip8::Op* handlers in Cpu.cpp
+ * (--verify-engine compares the two). Register operands X and Y are template parameters, so
+ * every handler is instantiated for the registers it works on and they are constants in
+ * generated code. Immediates N, NN and NNN are taken from opcode argument, one AND each.
+ * Instantiating for them too would mean ~44K handlers for no measurable gain. */
+struct Chip8Specialized
+{
+	typedef Chip8::SpecializedHandler Handler;
+
+	static const unsigned int CARRY_FLAG = NUM_REGISTERS - 1;
+
+	/* Whole table is one initializer list, every group of 0x1000 entries shares first nibble
+	 * of opcode. Handler addresses are constants, so compiler fills the table. */
+	template <std::size_t... Low>
+	static const Handler* Table(std::index_sequence<Low...>)
+	{
+		static constexpr Handler table[DISPATCH_TABLE_SIZE] = {
+			Family0(Low)...,
+			Same(Low, &Op1NNN)...,
+			Same(Low, &Op2NNN)...,
+			&Op3XNN<OPCODE_X(Low)>...,
+			&Op4XNN<OPCODE_X(Low)>...,
+			&Op5XY0<OPCODE_X(Low), OPCODE_Y(Low)>...,
+			&Op6XNN<OPCODE_X(Low)>...,
+			&Op7XNN<OPCODE_X(Low)>...,
+			Family8<OPCODE_X(Low), OPCODE_Y(Low)>(Low & 0xF)...,
+			&Op9XY0<OPCODE_X(Low), OPCODE_Y(Low)>...,
+			Same(Low, &OpANNN)...,
+			Same(Low, &OpBNNN)...,
+			&OpCXNN<OPCODE_X(Low)>...,
+			&OpDXYN<OPCODE_X(Low), OPCODE_Y(Low)>...,
+			FamilyE<OPCODE_X(Low)>(Low & 0xF)...,
+			FamilyF<OPCODE_X(Low)>(Low & 0xFF)...
+		};
+
+		return table;
+	}
+
+	// Handler within family picked by low bits of opcode, same cases as Chip8::Decode
+
+	/* Repeats handler once per opcode of family which doesn't depend on low bits. */
+	static constexpr Handler Same(std::size_t, Handler handler)
+	{
+		return handler;
+	}
+
+	static constexpr Handler Family0(std::size_t low)
+	{
+		return ((low & 0xF) == 0x0) ? &Op00E0 : ((low & 0xF) == 0xE) ? &Op00EE : &OpUnknown;
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static constexpr Handler Family8(std::size_t n)
+	{
+		return (n == 0x0) ? &Op8XY0<X, Y> : (n == 0x1) ? &Op8XY1<X, Y> : (n == 0x2) ? &Op8XY2<X, Y>
+			: (n == 0x3) ? &Op8XY3<X, Y> : (n == 0x4) ? &Op8XY4<X, Y> : (n == 0x5) ? &Op8XY5<X, Y>
+			: (n == 0x6) ? &Op8XY6<X, Y> : (n == 0x7) ? &Op8XY7<X, Y> : (n == 0xE) ? &Op8XYE<X, Y>
+			: &OpUnknown;
+	}
+
+	template <unsigned int X>
+	static constexpr Handler FamilyE(std::size_t n)
+	{
+		return (n == 0xE) ? &OpEX9E<X> : (n == 0x1) ? &OpEXA1<X> : &OpUnknown;
+	}
+
+	template <unsigned int X>
+	static constexpr Handler FamilyF(std::size_t nn)
+	{
+		return (nn == 0x07) ? &OpFX07<X> : (nn == 0x0A) ? &OpFX0A<X> : (nn == 0x15) ? &OpFX15<X>
+			: (nn == 0x18) ? &OpFX18<X> : (nn == 0x1E) ? &OpFX1E<X> : (nn == 0x29) ? &OpFX29<X>
+			: (nn == 0x33) ? &OpFX33<X> : (nn == 0x55) ? &OpFX55<X> : (nn == 0x65) ? &OpFX65<X>
+			: &OpUnknown;
+	}
+
+	static void Op00E0(Chip8& c, unsigned int)
+	{
+		for (int i = 0; i < SCREEN_HEIGHT; ++i)
+			c.gfx[i] = 0;
+
+		c.drawFlag = true;
+		c.dirtyRows = ALL_ROWS;
+		c.UpdatePC();
+		LOG_TRACE("[00E0] Display, clear the screen");
+	}
+
+	static void Op00EE(Chip8& c, unsigned int)
+	{
+		--c.sp;
+		c.pc = c.stack[c.sp];
+		c.UpdatePC();
+		LOG_TRACE("[00EE] Flow, return from subroutine");
+	}
+
+	static void Op1NNN(Chip8& c, unsigned int opcode)
+	{
+		c.pc = opcode & 0x0FFF;
+		LOG_TRACE("[1NNN] Flow, jump to NNN");
+	}
+
+	static void Op2NNN(Chip8& c, unsigned int opcode)
+	{
+		c.stack[c.sp] = c.pc;
+		++c.sp;
+		c.pc = opcode & 0x0FFF;
+		LOG_TRACE("[2NNN] Flow, calls subroutine at NNN");
+	}
+
+	template <unsigned int X>
+	static void Op3XNN(Chip8& c, unsigned int opcode)
+	{
+		c.pc += (c.V[X] == (opcode & 0xFF)) ? 4 : 2;
+		LOG_TRACE("[3XNN] Cond, skips instr. if VX==NN");
+	}
+
+	template <unsigned int X>
+	static void Op4XNN(Chip8& c, unsigned int opcode)
+	{
+		c.pc += (c.V[X] != (opcode & 0xFF)) ? 4 : 2;
+		LOG_TRACE("[4XNN] Cond, skips instr. if VX!=NN");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op5XY0(Chip8& c, unsigned int)
+	{
+		c.pc += (c.V[X] == c.V[Y]) ? 4 : 2;
+		LOG_TRACE("[5XY0] Cond, skips instr. if VX==VY");
+	}
+
+	template <unsigned int X>
+	static void Op6XNN(Chip8& c, unsigned int opcode)
+	{
+		c.V[X] = opcode & 0xFF;
+		LOG_TRACE("[6XNN] Const, set Vx = NN");
+		c.UpdatePC();
+	}
+
+	template <unsigned int X>
+	static void Op7XNN(Chip8& c, unsigned int opcode)
+	{
+		c.V[X] += opcode & 0xFF;
+		LOG_TRACE("[7XNN] Const, Vx += NN");
+		c.UpdatePC();
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY0(Chip8& c, unsigned int)
+	{
+		c.V[X] = c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY0] Assign, Vx = Vy");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY1(Chip8& c, unsigned int)
+	{
+		c.V[X] |= c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY1] BitOp, Vx = Vx | Vy");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY2(Chip8& c, unsigned int)
+	{
+		c.V[X] &= c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY2] BitOp, Vx = Vx & Vy");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY3(Chip8& c, unsigned int)
+	{
+		c.V[X] ^= c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY3] BitOp, Vx = Vx ^ Vy");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY4(Chip8& c, unsigned int)
+	{
+		c.V[CARRY_FLAG] = (c.V[Y] > 0xFF - c.V[X]) ? 1 : 0;
+		c.V[X] += c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY4] Math, Vx += Vy w/CF");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY5(Chip8& c, unsigned int)
+	{
+		c.V[CARRY_FLAG] = (c.V[X] < c.V[Y]) ? 0 : 1;
+		c.V[X] -= c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY5] Math, Vx -= Vy w/CF");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY6(Chip8& c, unsigned int)
+	{
+		c.V[CARRY_FLAG] = c.V[Y] & 0b00000001;
+		c.V[Y] >>= 1;
+		c.V[X] = c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XY6] BitOp, Vx=Vy=Vy>>1");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XY7(Chip8& c, unsigned int)
+	{
+		c.V[CARRY_FLAG] = (c.V[X] > c.V[Y]) ? 0 : 1;
+		c.V[X] = c.V[Y] - c.V[X];
+		c.UpdatePC();
+		LOG_TRACE("[8XY7] Math, Vx = Vy - Vx");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op8XYE(Chip8& c, unsigned int)
+	{
+		c.V[CARRY_FLAG] = c.V[Y] & 0b00000001;
+		c.V[Y] <<= 1;
+		c.V[X] = c.V[Y];
+		c.UpdatePC();
+		LOG_TRACE("[8XYE] BitOp, Vx=Vy=Vy<<1");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void Op9XY0(Chip8& c, unsigned int)
+	{
+		c.pc += (c.V[X] != c.V[Y]) ? 4 : 2;
+		LOG_TRACE("[9XY0] Cond, skips instr. if Vx != Vy");
+	}
+
+	static void OpANNN(Chip8& c, unsigned int opcode)
+	{
+		c.I = opcode & 0x0FFF;
+		c.UpdatePC();
+		LOG_TRACE("[ANNN] MEM, I = NNN");
+	}
+
+	static void OpBNNN(Chip8& c, unsigned int opcode)
+	{
+		c.pc = (c.V[0] + (opcode & 0x0FFF)) & 0x0FFF;
+		LOG_TRACE("[BNNN] Flow, pc = V0 + NNN");
+	}
+
+	template <unsigned int X>
+	static void OpCXNN(Chip8& c, unsigned int opcode)
+	{
+		c.V[X] = (c.random.Next() % 255) & opcode & 0xFF;
+		c.UpdatePC();
+		LOG_TRACE("[CXNN] Rand, Vx = random % 255 & NN");
+	}
+
+	template <unsigned int X, unsigned int Y>
+	static void OpDXYN(Chip8& c, unsigned int opcode)
+	{
+		c.DrawSprite(c.V[X], c.V[Y], opcode & 0xF);
+		c.UpdatePC();
+		LOG_TRACE("[DXYN] Disp, draw(Vx, Vy, N)");
+	}
+
+	template <unsigned int X>
+	static void OpEX9E(Chip8& c, unsigned int)
+	{
+		c.pc += (c.key[c.V[X]] != 0) ? 4 : 2;
+		LOG_TRACE("[EX9E] KeyOp, skips instr. if key in Vx is pressed");
+	}
+
+	template <unsigned int X>
+	static void OpEXA1(Chip8& c, unsigned int)
+	{
+		c.pc += (c.key[c.V[X]] == 0) ? 4 : 2;
+		LOG_TRACE("[EXA1] KeyOp, skips instr. if key in Vx isn't pressed");
+	}
+
+	template <unsigned int X>
+	static void OpFX07(Chip8& c, unsigned int)
+	{
+		c.V[X] = c.delayTimer;
+		c.UpdatePC();
+		LOG_TRACE("[FX07] Timer, Vx = delayTimer");
+	}
+
+	template <unsigned int X>
+	static void OpFX0A(Chip8& c, unsigned int)
+	{
+		bool keyPressed = false;
+
+		// The last pressed key wins, as in Chip8::OpFX0A
+		for (int i = 0; i < NUM_KEYS; ++i)
+		{
+			if (c.key[i] != 0)
+			{
+				c.V[X] = i;
+				keyPressed = true;
+			}
+		}
+
+		if (keyPressed)
+			c.UpdatePC();
+
+		LOG_TRACE("[FX0A] KeyOp, Wait for a key to be pressed");
+	}
+
+	template <unsigned int X>
+	static void OpFX15(Chip8& c, unsigned int)
+	{
+		c.delayTimer = c.V[X];
+		c.UpdatePC();
+		LOG_TRACE("[FX15] Timer, delayTimer = Vx");
+	}
+
+	template <unsigned int X>
+	static void OpFX18(Chip8& c, unsigned int)
+	{
+		c.soundTimer = c.V[X];
+		c.UpdatePC();
+		LOG_TRACE("[FX18] Sound, soundTimer = Vx");
+	}
+
+	template <unsigned int X>
+	static void OpFX1E(Chip8& c, unsigned int)
+	{
+		c.I += c.V[X];
+		c.UpdatePC();
+		LOG_TRACE("[FX1E] MEM, I += Vx");
+	}
+
+	template <unsigned int X>
+	static void OpFX29(Chip8& c, unsigned int)
+	{
+		c.I = c.V[X] * 5;
+		c.UpdatePC();
+		LOG_TRACE("[FX29] MEM, Set I to te location of the sprite");
+	}
+
+	template <unsigned int X>
+	static void OpFX33(Chip8& c, unsigned int)
+	{
+		c.WriteMemory(c.I, c.V[X] / 100);
+		c.WriteMemory(c.I + 1, (c.V[X] / 10) % 10);
+		c.WriteMemory(c.I + 2, c.V[X] % 10);
+		c.UpdatePC();
+		LOG_TRACE("[FX33] BCD");
+	}
+
+	template <unsigned int X>
+	static void OpFX55(Chip8& c, unsigned int)
+	{
+		for (unsigned int i = 0; i <= X; ++i)
+			c.WriteMemory(c.I++, c.V[i]);
+
+		c.UpdatePC();
+		LOG_TRACE("[FX55] MEM, reg_dump(Vx, &I)");
+	}
+
+	template <unsigned int X>
+	static void OpFX65(Chip8& c, unsigned int)
+	{
+		for (unsigned int i = 0; i <= X; ++i)
+			c.V[i] = c.memory[c.I++];
+
+		c.UpdatePC();
+		LOG_TRACE("[FX65] MEM, reg_load(Vx, &I)");
+	}
+
+	static void OpUnknown(Chip8& c, unsigned int opcode)
+	{
+		c.OpUnknown(Chip8::Decode(opcode));
+	}
+};
+
+/* Handler for every 16-bit opcode, built at compile time. */
+const Chip8::SpecializedHandler* Chip8::DispatchTable()
+{
+	return Chip8Specialized::Table(std::make_index_sequence<0x1000>());
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "FramePacer.h"
+#include <thread>
+
+#define SPIN_THRESHOLD std::chrono::milliseconds(1)		// sleep until this close to deadline, then spin
+#define MAX_FRAMES_BEHIND 3								// skip catching up if loop fell further behind than this
+
+FramePacer::FramePacer(unsigned int frequency)
+	: frameDuration(std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / frequency)
+{
+	Reset();
+}
+
+/* Starts counting frames from now. */
+void FramePacer::Reset()
+{
+	nextFrame = Clock::now() + frameDuration;
+}
+
+/* Waits until the end of current frame. */
+void FramePacer::Wait()
+{
+	Clock::time_point now = Clock::now();
+
+	// Loop was stalled (window moved, debugger...), start over instead of running frames back to back
+	if (now > nextFrame + frameDuration * MAX_FRAMES_BEHIND)
+	{
+		Reset();
+		return;
+	}
+
+	if (nextFrame - now > SPIN_THRESHOLD)
+		std::this_thread::sleep_for(nextFrame - now - SPIN_THRESHOLD);
+
+	while (Clock::now() < nextFrame)
+		std::this_thread::yield();
+
+	nextFrame += frameDuration;
+}
\ No newline at end of file
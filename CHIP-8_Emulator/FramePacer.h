@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+
+/* Keeps loop running at fixed frequency. Wait() sleeps until the next frame deadline,
+ * the last bit of waiting is spinning because sleep isn't precise enough on all systems. */
+class FramePacer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	explicit FramePacer(unsigned int frequency);
+
+	void Wait();
+	void Reset();
+
+private:
+	Clock::duration frameDuration;
+	Clock::time_point nextFrame;						// deadline of current frame
+};
\ No newline at end of file
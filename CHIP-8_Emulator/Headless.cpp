@@ -0,0 +1,153 @@
+#include "Headless.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+/* Parses one "<frame> <key> <state>" line of input script. */
+bool ParseKeyEvent(const std::string& line, KeyEvent& event)
+{
+	std::istringstream fields(line);
+	unsigned int frame, key, state;
+	if (!(fields >> std::dec >> frame >> std::hex >> key >> std::dec >> state) || key >= NUM_KEYS || state > 1)
+		return false;
+
+	event.frame = frame;
+	event.key   = (unsigned char)key;
+	event.state = (unsigned char)state;
+	return true;
+}
+
+/* Reads input script. Every line is "<frame> <key> <state>", key is hex digit 0 - F and state
+ * is 1 for press or 0 for release. Empty lines and lines starting with # are skipped. */
+bool LoadInputScript(const std::string& scriptPath, std::vector<KeyEvent>& events)
+{
+	std::ifstream scriptFile(scriptPath);
+	if (!scriptFile)
+	{
+		LOG_ERROR("Error (input script): Can't open " + scriptPath);
+		return false;
+	}
+
+	std::string line;
+	for (int lineNumber = 1; std::getline(scriptFile, line); ++lineNumber)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		KeyEvent event;
+		if (!ParseKeyEvent(line, event))
+		{
+			LOG_ERROR("Error (input script): Bad line " + std::to_string(lineNumber) + " in " + scriptPath);
+			return false;
+		}
+
+		events.push_back(event);
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const KeyEvent& a, const KeyEvent& b) { return a.frame < b.frame; });
+	return true;
+}
+
+/* Runs emulation without window until frame or cycle limit is reached. Frames are 60 Hz frames
+ * of emulated time, key events from input script are applied at the start of their frame.
+ * Without any limit nothing is run, replay of movie with 0 frames relies on that. */
+HeadlessResult RunHeadless(Chip8& chip, const HeadlessOptions& options)
+{
+	HeadlessResult result;
+	result.frames = 0;
+
+	unsigned long long startCycles = chip.CycleCount();
+	unsigned long long startIdleCycles = chip.IdleCyclesSkipped();
+	size_t nextEvent = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
+	while (result.frames < options.frames || (options.frames == 0 && options.maxCycles != 0))
+	{
+		unsigned long long cyclesDone = chip.CycleCount() - startCycles;
+		if (options.maxCycles != 0 && cyclesDone >= options.maxCycles)
+			break;
+
+		for (; nextEvent < options.input.size() && options.input[nextEvent].frame <= result.frames; ++nextEvent)
+			chip.SetKey(options.input[nextEvent].key, options.input[nextEvent].state);
+
+		unsigned int frameCycles = chip.CyclesUntilTimerTick();
+		if (options.maxCycles != 0 && options.maxCycles - cyclesDone < frameCycles)
+			frameCycles = (unsigned int)(options.maxCycles - cyclesDone);
+
+		chip.EmulateCycles(frameCycles);
+		chip.CaptureFrame();
+		++result.frames;
+	}
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	result.cycles = chip.CycleCount() - startCycles;
+	result.idleCycles = chip.IdleCyclesSkipped() - startIdleCycles;
+	result.framebufferHash = chip.FramebufferHash();
+	return result;
+}
+
+/* Compares everything that defines machine. Opcode is left out, it's scratch register
+ * which translated code doesn't update. */
+static bool SameState(const MachineState& a, const MachineState& b)
+{
+	return memcmp(a.gfx, b.gfx, sizeof(a.gfx)) == 0 && memcmp(a.memory, b.memory, sizeof(a.memory)) == 0
+		&& memcmp(a.stack, b.stack, sizeof(a.stack)) == 0 && memcmp(a.key, b.key, sizeof(a.key)) == 0
+		&& memcmp(a.V, b.V, sizeof(a.V)) == 0 && a.I == b.I && a.pc == b.pc && a.sp == b.sp
+		&& a.delayTimer == b.delayTimer && a.soundTimer == b.soundTimer && a.timerPhase == b.timerPhase
+		&& a.cycleCount == b.cycleCount && a.random.state == b.random.state;
+}
+
+/* Runs two chips with the same ROM, seed and input side by side, one 60 Hz frame at a time,
+ * and compares their machine states after every frame. Used to check that an engine gives
+ * exactly the same results as reference interpreter. Returns number of the first frame after
+ * which states differ, 0 if they match for all options.frames frames. */
+unsigned int CompareEngines(Chip8& reference, Chip8& tested, const HeadlessOptions& options)
+{
+	size_t nextEvent = 0;
+
+	for (unsigned int frame = 0; frame < options.frames; ++frame)
+	{
+		for (; nextEvent < options.input.size() && options.input[nextEvent].frame <= frame; ++nextEvent)
+		{
+			reference.SetKey(options.input[nextEvent].key, options.input[nextEvent].state);
+			tested.SetKey(options.input[nextEvent].key, options.input[nextEvent].state);
+		}
+
+		reference.EmulateFrame();
+		tested.EmulateFrame();
+
+		MachineState expected, actual;
+		reference.Snapshot(expected);
+		tested.Snapshot(actual);
+
+		if (!SameState(expected, actual))
+		{
+			printf("engines differ after frame %u: pc %03X / %03X, cycles %llu / %llu\n", frame + 1,
+				expected.pc, actual.pc, expected.cycleCount, actual.cycleCount);
+			return frame + 1;
+		}
+	}
+
+	printf("engines match for %u frames\n", options.frames);
+	return 0;
+}
+
+/* Writes result of headless run to console. */
+void PrintResult(const HeadlessResult& result)
+{
+	// Skipped cycles cost nothing, speed counts only instructions which really ran
+	unsigned long long executed = result.cycles - result.idleCycles;
+	double instructionsPerSecond = (result.seconds > 0.0) ? executed / result.seconds : 0.0;
+
+	printf("frames: %u\n", result.frames);
+	printf("cycles: %llu\n", result.cycles);
+	printf("executed instructions: %llu\n", executed);
+	printf("idle cycles skipped: %llu\n", result.idleCycles);
+	printf("time: %.6f s\n", result.seconds);
+	printf("instructions/s: %.0f\n", instructionsPerSecond);
+	printf("framebuffer: %08X\n", result.framebufferHash);
+}
\ No newline at end of file
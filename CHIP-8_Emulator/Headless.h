@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Cpu.h"
+
+#define DEFAULT_HEADLESS_FRAMES 600						// used when neither frame nor cycle limit is given
+
+// Change of key state, applied at the start of frame
+struct KeyEvent
+{
+	unsigned int frame;
+	unsigned char key;									// Chip8 key 0 - F
+	unsigned char state;								// 1 pressed, 0 released
+};
+
+struct HeadlessOptions
+{
+	unsigned int frames;								// 0 for no frame limit if maxCycles is set, else no frames
+	unsigned long long maxCycles;						// 0 for no cycle limit
+	std::vector<KeyEvent> input;						// sorted by frame
+};
+
+struct HeadlessResult
+{
+	unsigned int frames;
+	unsigned long long cycles;
+	unsigned long long idleCycles;						// part of cycles skipped by idle loop detection
+	double seconds;
+	unsigned int framebufferHash;						// Chip8::FramebufferHash at the end of run
+};
+
+bool ParseKeyEvent(const std::string& line, KeyEvent& event);
+bool LoadInputScript(const std::string& scriptPath, std::vector<KeyEvent>& events);
+HeadlessResult RunHeadless(Chip8& chip, const HeadlessOptions& options);
+unsigned int CompareEngines(Chip8& reference, Chip8& tested, const HeadlessOptions& options);
+void PrintResult(const HeadlessResult& result);
\ No newline at end of file
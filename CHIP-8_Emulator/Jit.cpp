@@ -0,0 +1,793 @@
+#include "Jit.h"
+#include "Log.h"
+#include <cstddef>
+#include <cstring>
+
+#ifdef JIT_X64
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Host registers by their x86 encoding
+enum X64Register { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define STATE_REGISTER RBX								// MachineState* for the whole block
+#define CHIP_REGISTER  RBP								// Chip8* passed to handlers
+#define I_REGISTER     R12
+
+// Arguments of block and of handlers it calls
+#ifdef _WIN32
+#define ARGUMENT_0 RCX
+#define ARGUMENT_1 RDX
+#else
+#define ARGUMENT_0 RDI
+#define ARGUMENT_1 RSI
+#endif
+
+#define SIZE_8  1
+#define SIZE_16 2
+#define SIZE_32 4
+#define SIZE_64 8
+
+// ALU operations, used as opcode extension (80 /op) and as opcode base (op * 8)
+#define ALU_ADD 0
+#define ALU_OR  1
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_XOR 6
+#define ALU_CMP 7
+
+#define SHIFT_LEFT  4
+#define SHIFT_RIGHT 5
+
+#define CONDITION_BELOW     0x2							// carry set
+#define CONDITION_NOT_BELOW 0x3							// carry clear
+#define CONDITION_EQUAL     0x4
+#define CONDITION_NOT_EQUAL 0x5
+
+#define STATE_OFFSET(field) ((int)offsetof(MachineState, field))
+
+// Caller-saved ones first, they don't have to be pushed. RSI and RDI are callee-saved on Windows.
+static const int V_HOST_REGISTERS[JIT_CACHED_REGISTERS] = { R8, R9, R10, R11, R13, R14, R15, RSI, RDI };
+
+static bool CalleeSaved(int reg)
+{
+	return reg == RBX || reg == RBP || reg == RSI || reg == RDI || reg >= R12;
+}
+
+static unsigned char* AllocateCode(size_t size)
+{
+#ifdef _WIN32
+	return (unsigned char*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (memory != MAP_FAILED) ? (unsigned char*)memory : nullptr;
+#endif
+}
+
+static void FreeCode(unsigned char* memory, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
+
+/* Code memory is never writable and executable at once. */
+static bool ProtectCode(unsigned char* memory, size_t size, bool executable)
+{
+#ifdef _WIN32
+	DWORD previous;
+	if (!VirtualProtect(memory, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous))
+		return false;
+
+	return !executable || FlushInstructionCache(GetCurrentProcess(), memory, size) != 0;
+#else
+	return mprotect(memory, size, executable ? (PROT_READ | PROT_EXEC) : (PROT_READ | PROT_WRITE)) == 0;
+#endif
+}
+
+JitCompiler::JitCompiler()
+	: codeUsed(0), pendingCycles(0), instructionsPerSecond(0), exitAddress(0)
+{
+	codeMemory = AllocateCode(JIT_CODE_SIZE);
+	if (codeMemory == nullptr)
+		LOG_WARNING("Warning (jit): Can't allocate memory for native code.");
+
+	for (int i = 0; i < MEMORY_SIZE; ++i)
+		blocks[i] = nullptr;
+}
+
+JitCompiler::~JitCompiler()
+{
+	if (codeMemory != nullptr)
+		FreeCode(codeMemory, JIT_CODE_SIZE);
+}
+
+bool JitCompiler::Valid() const
+{
+	return codeMemory != nullptr;
+}
+
+JitBlock JitCompiler::Block(unsigned short start) const
+{
+	return blocks[start];
+}
+
+/* Drops all compiled blocks, so code memory can be filled again. */
+void JitCompiler::Flush(Chip8& chip)
+{
+	codeUsed = 0;
+
+	for (int i = 0; i < MEMORY_SIZE; ++i)
+	{
+		blocks[i] = nullptr;
+		chip.blockLength[i] = 0;
+	}
+}
+
+/* Compiles block of length instructions at start, which BuildBlock has just put to decode cache. */
+void JitCompiler::Compile(Chip8& chip, unsigned short start, unsigned int length)
+{
+	code.clear();
+	instructionsPerSecond = chip.instructionsPerSecond;
+	pendingCycles = 0;
+	AllocateRegisters(chip, start, length);
+	EmitPrologue();
+
+	BlockExit exit = EXIT_NONE;
+	for (unsigned int i = 0; i < length && exit == EXIT_NONE; ++i)
+	{
+		unsigned short address = start + i * 2;
+		exit = EmitInstruction(chip.decodeCache[address], address);
+		++pendingCycles;
+	}
+
+	if (exit == EXIT_NONE)
+	{
+		exitAddress = start + length * 2;
+		exit = EXIT_CONSTANT;
+	}
+
+	EmitExit(exit);
+
+	if (codeUsed + code.size() > JIT_CODE_SIZE)
+	{
+		Flush(chip);
+		chip.blockLength[start] = length;
+	}
+
+	// Only pages the block is copied to become writable for a while
+	unsigned char* target = codeMemory + codeUsed;
+	size_t firstPage = codeUsed & ~(size_t)(JIT_PAGE_SIZE - 1);
+	size_t endPage = (codeUsed + code.size() + JIT_PAGE_SIZE - 1) & ~(size_t)(JIT_PAGE_SIZE - 1);
+
+	if (!ProtectCode(codeMemory + firstPage, endPage - firstPage, false))
+		LOG_ERROR("Error (jit): Can't make code memory writable.");
+
+	memcpy(target, code.data(), code.size());
+
+	if (!ProtectCode(codeMemory + firstPage, endPage - firstPage, true))
+		LOG_ERROR("Error (jit): Can't make code memory executable.");
+
+	blocks[start] = (JitBlock)target;
+	codeUsed += (code.size() + 15) & ~(size_t)15;
+}
+
+/* Keeps V registers used at least twice in host registers, the most used ones if there are
+ * more than JIT_CACHED_REGISTERS. Handlers read and write V in memory, so they don't count. */
+void JitCompiler::AllocateRegisters(const Chip8& chip, unsigned short start, unsigned int length)
+{
+	unsigned int uses[NUM_REGISTERS] = { 0 };
+
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		const Chip8::DecodedInstruction& instr = chip.decodeCache[start + i * 2];
+
+		switch (instr.opcode & 0xF000)
+		{
+		case 0x3000: case 0x4000: case 0x6000: case 0x7000: case 0xE000:
+			++uses[instr.x];
+			break;
+
+		case 0x5000: case 0x9000:
+			++uses[instr.x];
+			++uses[instr.y];
+			break;
+
+		case 0x8000:
+			++uses[instr.x];
+			++uses[instr.y];
+			if (instr.n >= 0x4)
+				++uses[NUM_REGISTERS - 1];
+			break;
+
+		case 0xB000:
+			++uses[0];
+			break;
+
+		case 0xF000:
+			if (instr.nn == 0x65)
+			{
+				for (unsigned int r = 0; r <= instr.x; ++r)
+					++uses[r];
+			}
+			else if (instr.nn != 0x0A && instr.nn != 0x33 && instr.nn != 0x55)
+			{
+				++uses[instr.x];
+			}
+			break;
+		}
+
+		if (instr.handler == &Chip8::OpUnknown)
+			break;
+	}
+
+	for (int i = 0; i < NUM_REGISTERS; ++i)
+	{
+		hostRegister[i] = -1;
+		dirty[i] = false;
+	}
+
+	dirtyI = false;
+
+	for (int slot = 0; slot < JIT_CACHED_REGISTERS; ++slot)
+	{
+		int best = -1;
+		for (int i = 0; i < NUM_REGISTERS; ++i)
+			if (hostRegister[i] < 0 && uses[i] >= 2 && (best < 0 || uses[i] > uses[best]))
+				best = i;
+
+		if (best < 0)
+			break;
+
+		hostRegister[best] = V_HOST_REGISTERS[slot];
+	}
+
+	savedRegisters.clear();
+	savedRegisters.push_back(STATE_REGISTER);
+	savedRegisters.push_back(CHIP_REGISTER);
+	savedRegisters.push_back(I_REGISTER);
+
+	for (int i = 0; i < NUM_REGISTERS; ++i)
+		if (hostRegister[i] >= 0 && CalleeSaved(hostRegister[i]))
+			savedRegisters.push_back(hostRegister[i]);
+}
+
+/* Emits one instruction, same semantics as Chip8 handler of it. */
+JitCompiler::BlockExit JitCompiler::EmitInstruction(const Chip8::DecodedInstruction& instr, unsigned short address)
+{
+	if (instr.handler == &Chip8::OpUnknown)
+	{
+		EmitInterpreted(instr.opcode, address, true);
+		return EXIT_STATE;
+	}
+
+	switch (instr.opcode & 0xF000)
+	{
+	case 0x0000:
+		if (instr.n == 0x0)
+		{
+			EmitInterpreted(instr.opcode, address, false);
+			return EXIT_NONE;
+		}
+
+		// 00EE, pc = stack[--sp] + 2
+		EmitModRM(SIZE_8, 0x80, ALU_SUB, StateMemory(STATE_OFFSET(sp)));
+		Byte(1);
+		EmitModRM(SIZE_8, 0x0FB6, RAX, StateMemory(STATE_OFFSET(sp)));
+		EmitModRM(SIZE_32, 0x0FB7, RDX, StateMemory(STATE_OFFSET(stack), RAX, 2));
+		EmitModRM(SIZE_32, 0x81, ALU_ADD, HostRegister(RDX));
+		Dword(2);
+		return EXIT_EDX;
+
+	case 0x1000:
+		exitAddress = instr.nnn;
+		return EXIT_CONSTANT;
+
+	case 0x2000:
+		// stack[sp++] = pc
+		EmitModRM(SIZE_8, 0x0FB6, RAX, StateMemory(STATE_OFFSET(sp)));
+		EmitModRM(SIZE_16, 0xC7, 0, StateMemory(STATE_OFFSET(stack), RAX, 2));
+		Byte(address & 0xFF);
+		Byte(address >> 8);
+		EmitModRM(SIZE_8, 0x80, ALU_ADD, StateMemory(STATE_OFFSET(sp)));
+		Byte(1);
+		exitAddress = instr.nnn;
+		return EXIT_CONSTANT;
+
+	case 0x3000:
+	case 0x4000:
+		EmitModRM(SIZE_8, 0x80, ALU_CMP, RegisterV(instr.x));
+		Byte(instr.nn);
+		return EmitSkip(((instr.opcode & 0xF000) == 0x3000) ? CONDITION_EQUAL : CONDITION_NOT_EQUAL, address);
+
+	case 0x5000:
+	case 0x9000:
+		EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(instr.x));
+		EmitModRM(SIZE_8, ALU_CMP * 8 + 2, RAX, RegisterV(instr.y));
+		return EmitSkip(((instr.opcode & 0xF000) == 0x5000) ? CONDITION_EQUAL : CONDITION_NOT_EQUAL, address);
+
+	case 0x6000:
+		EmitModRM(SIZE_8, 0xC6, 0, RegisterV(instr.x));
+		Byte(instr.nn);
+		Written(instr.x);
+		return EXIT_NONE;
+
+	case 0x7000:
+		EmitModRM(SIZE_8, 0x80, ALU_ADD, RegisterV(instr.x));
+		Byte(instr.nn);
+		Written(instr.x);
+		return EXIT_NONE;
+
+	case 0x8000:
+		return EmitArithmetic(instr);
+
+	case 0xA000:
+		MoveImmediate(I_REGISTER, instr.nnn);
+		dirtyI = true;
+		return EXIT_NONE;
+
+	case 0xB000:
+		// pc = (V0 + NNN) & 0xFFF
+		EmitModRM(SIZE_8, 0x0FB6, RDX, RegisterV(0));
+		EmitModRM(SIZE_32, 0x81, ALU_ADD, HostRegister(RDX));
+		Dword(instr.nnn);
+		EmitModRM(SIZE_32, 0x81, ALU_AND, HostRegister(RDX));
+		Dword(0x0FFF);
+		return EXIT_EDX;
+
+	case 0xC000:
+	case 0xD000:
+		EmitInterpreted(instr.opcode, address, false);
+		return EXIT_NONE;
+
+	case 0xE000:
+		// Key pressed is key[Vx] != 0
+		EmitModRM(SIZE_8, 0x0FB6, RAX, RegisterV(instr.x));
+		EmitModRM(SIZE_8, 0x80, ALU_CMP, StateMemory(STATE_OFFSET(key), RAX));
+		Byte(0);
+		return EmitSkip((instr.n == 0xE) ? CONDITION_NOT_EQUAL : CONDITION_EQUAL, address);
+	}
+
+	switch (instr.nn)
+	{
+	case 0x07:
+		EmitSyncTimers();
+		EmitModRM(SIZE_8, 0x8A, RAX, StateMemory(STATE_OFFSET(delayTimer)));
+		EmitModRM(SIZE_8, 0x88, RAX, RegisterV(instr.x));
+		Written(instr.x);
+		return EXIT_NONE;
+
+	case 0x15:
+	case 0x18:
+		EmitSyncTimers();
+		EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(instr.x));
+		EmitModRM(SIZE_8, 0x88, RAX, StateMemory((instr.nn == 0x15) ? STATE_OFFSET(delayTimer) : STATE_OFFSET(soundTimer)));
+		return EXIT_NONE;
+
+	case 0x1E:
+		// I is 16 bit
+		EmitModRM(SIZE_8, 0x0FB6, RAX, RegisterV(instr.x));
+		EmitModRM(SIZE_32, ALU_ADD * 8 + 3, I_REGISTER, HostRegister(RAX));
+		EmitModRM(SIZE_32, 0x0FB7, I_REGISTER, HostRegister(I_REGISTER));
+		dirtyI = true;
+		return EXIT_NONE;
+
+	case 0x29:
+		EmitModRM(SIZE_8, 0x0FB6, RAX, RegisterV(instr.x));
+		EmitModRM(SIZE_32, 0x6B, I_REGISTER, HostRegister(RAX));
+		Byte(5);
+		dirtyI = true;
+		return EXIT_NONE;
+
+	case 0x65:
+		// V0 - Vx = memory[I], memory[I + 1]...
+		for (unsigned int i = 0; i <= instr.x; ++i)
+		{
+			EmitModRM(SIZE_32, 0x8B, RAX, HostRegister(I_REGISTER));
+			if (i > 0)
+			{
+				EmitModRM(SIZE_32, 0x81, ALU_ADD, HostRegister(RAX));
+				Dword(i);
+			}
+
+			EmitModRM(SIZE_32, 0x0FB7, RAX, HostRegister(RAX));
+			EmitModRM(SIZE_8, 0x8A, RCX, StateMemory(STATE_OFFSET(memory), RAX));
+			EmitModRM(SIZE_8, 0x88, RCX, RegisterV(i));
+			Written(i);
+		}
+
+		EmitModRM(SIZE_32, 0x81, ALU_ADD, HostRegister(I_REGISTER));
+		Dword(instr.x + 1);
+		EmitModRM(SIZE_32, 0x0FB7, I_REGISTER, HostRegister(I_REGISTER));
+		dirtyI = true;
+		return EXIT_NONE;
+	}
+
+	// FX0A waits for key, FX33 and FX55 write memory which can hold this block
+	EmitInterpreted(instr.opcode, address, true);
+	return EXIT_STATE;
+}
+
+/* 8XYN. Flag is computed from values before the operation and written first, as handlers do,
+ * which matters when X or Y is VF. */
+JitCompiler::BlockExit JitCompiler::EmitArithmetic(const Chip8::DecodedInstruction& instr)
+{
+	const unsigned int CARRY_FLAG = NUM_REGISTERS - 1;
+	bool flagOperand = (instr.x == CARRY_FLAG || instr.y == CARRY_FLAG);
+	unsigned int x = instr.x;
+	unsigned int y = instr.y;
+
+	switch (instr.n)
+	{
+	case 0x0:
+		EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(y));
+		EmitModRM(SIZE_8, 0x88, RAX, RegisterV(x));
+		Written(x);
+		break;
+
+	case 0x1:
+	case 0x2:
+	case 0x3:
+	{
+		int operation = (instr.n == 0x1) ? ALU_OR : (instr.n == 0x2) ? ALU_AND : ALU_XOR;
+		EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(x));
+		EmitModRM(SIZE_8, operation * 8 + 2, RAX, RegisterV(y));
+		EmitModRM(SIZE_8, 0x88, RAX, RegisterV(x));
+		Written(x);
+		break;
+	}
+
+	case 0x4:
+	case 0x5:
+	case 0x7:
+	{
+		// VF is carry of Vx + Vy, no borrow of Vx - Vy or no borrow of Vy - Vx
+		int operation = (instr.n == 0x4) ? ALU_ADD : ALU_SUB;
+		int condition = (instr.n == 0x4) ? CONDITION_BELOW : CONDITION_NOT_BELOW;
+		unsigned int left = (instr.n == 0x7) ? y : x;
+		unsigned int right = (instr.n == 0x7) ? x : y;
+
+		EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(left));
+		EmitModRM(SIZE_8, operation * 8 + 2, RAX, RegisterV(right));
+		EmitModRM(SIZE_8, 0x0F90 + condition, 0, HostRegister(RCX));
+
+		if (flagOperand)
+		{
+			EmitModRM(SIZE_8, 0x88, RCX, RegisterV(CARRY_FLAG));
+			EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(left));
+			EmitModRM(SIZE_8, operation * 8 + 2, RAX, RegisterV(right));
+			EmitModRM(SIZE_8, 0x88, RAX, RegisterV(x));
+		}
+		else
+		{
+			EmitModRM(SIZE_8, 0x88, RAX, RegisterV(x));
+			EmitModRM(SIZE_8, 0x88, RCX, RegisterV(CARRY_FLAG));
+		}
+
+		Written(x);
+		Written(CARRY_FLAG);
+		break;
+	}
+
+	case 0x6:
+	case 0xE:
+		// VF = lowest bit of Vy (for both shifts, as in handlers), Vx = Vy = shifted Vy
+		EmitModRM(SIZE_8, 0x8A, RCX, RegisterV(y));
+		EmitModRM(SIZE_8, 0x80, ALU_AND, HostRegister(RCX));
+		Byte(0x01);
+		EmitModRM(SIZE_8, 0x88, RCX, RegisterV(CARRY_FLAG));
+		EmitModRM(SIZE_8, 0x8A, RAX, RegisterV(y));
+		EmitModRM(SIZE_8, 0xD0, (instr.n == 0x6) ? SHIFT_RIGHT : SHIFT_LEFT, HostRegister(RAX));
+		EmitModRM(SIZE_8, 0x88, RAX, RegisterV(y));
+		EmitModRM(SIZE_8, 0x88, RAX, RegisterV(x));
+		Written(CARRY_FLAG);
+		Written(y);
+		Written(x);
+		break;
+	}
+
+	return EXIT_NONE;
+}
+
+/* Conditional skip at end of block, pc goes to address + 4 if condition holds, else to address + 2. */
+JitCompiler::BlockExit JitCompiler::EmitSkip(int condition, unsigned short address)
+{
+	MoveImmediate(RDX, address + 2);
+	MoveImmediate(RCX, address + 4);
+	EmitModRM(SIZE_32, 0x0F40 + condition, RDX, HostRegister(RCX));
+	return EXIT_EDX;
+}
+
+/* Calls dispatch table handler of opcode, with machine state in memory as handler expects it. */
+void JitCompiler::EmitInterpreted(unsigned short opcode, unsigned short address, bool endsBlock)
+{
+	EmitWriteBack();
+
+	EmitModRM(SIZE_16, 0xC7, 0, StateMemory(STATE_OFFSET(pc)));
+	Byte(address & 0xFF);
+	Byte(address >> 8);
+
+	EmitModRM(SIZE_64, 0x8B, ARGUMENT_0, HostRegister(CHIP_REGISTER));
+	MoveImmediate(ARGUMENT_1, opcode);
+	MoveImmediate64(RAX, (uint64_t)Chip8::DispatchTable()[opcode]);
+	Byte(0xFF);
+	Byte(0xD0);											// call rax
+
+	// Block which ends here keeps what handler left in memory
+	if (!endsBlock)
+		EmitReload();
+}
+
+/* Saves callee-saved registers, keeps stack aligned to 16 bytes with 32 bytes of shadow space
+ * for handler calls, and loads state to host registers. */
+void JitCompiler::EmitPrologue()
+{
+	for (int reg : savedRegisters)
+	{
+		if (reg >= R8)
+			Byte(0x41);
+		Byte(0x50 + (reg & 7));
+	}
+
+	// Return address and pushes leave stack aligned when their count is even
+	unsigned int frameSize = (savedRegisters.size() % 2 == 1) ? 32 : 40;
+	EmitModRM(SIZE_64, 0x81, ALU_SUB, HostRegister(RSP));
+	Dword(frameSize);
+
+	EmitModRM(SIZE_64, 0x8B, STATE_REGISTER, HostRegister(ARGUMENT_0));
+	EmitModRM(SIZE_64, 0x8B, CHIP_REGISTER, HostRegister(ARGUMENT_1));
+	EmitReload();
+}
+
+/* Brings timers up to date, writes registers back, stores pc and returns. */
+void JitCompiler::EmitExit(BlockExit exit)
+{
+	EmitSyncTimers();
+	EmitWriteBack();
+
+	if (exit == EXIT_CONSTANT)
+	{
+		EmitModRM(SIZE_16, 0xC7, 0, StateMemory(STATE_OFFSET(pc)));
+		Byte(exitAddress & 0xFF);
+		Byte(exitAddress >> 8);
+	}
+	else if (exit == EXIT_EDX)
+	{
+		EmitModRM(SIZE_16, 0x89, RDX, StateMemory(STATE_OFFSET(pc)));
+	}
+
+	unsigned int frameSize = (savedRegisters.size() % 2 == 1) ? 32 : 40;
+	EmitModRM(SIZE_64, 0x81, ALU_ADD, HostRegister(RSP));
+	Dword(frameSize);
+
+	for (size_t i = savedRegisters.size(); i-- > 0; )
+	{
+		int reg = savedRegisters[i];
+		if (reg >= R8)
+			Byte(0x41);
+		Byte(0x58 + (reg & 7));
+	}
+
+	Byte(0xC3);
+}
+
+/* Updates cycle count and timers for pending cycles, as UpdateTimers would after each of them.
+ * Rate is at least TIMER_FREQUENCY, so one cycle never makes more than one tick. Uses only EAX. */
+void JitCompiler::EmitSyncTimers()
+{
+	if (pendingCycles == 0)
+		return;
+
+	EmitModRM(SIZE_64, 0x81, ALU_ADD, StateMemory(STATE_OFFSET(cycleCount)));
+	Dword(pendingCycles);
+
+	EmitModRM(SIZE_32, 0x8B, RAX, StateMemory(STATE_OFFSET(timerPhase)));
+	EmitModRM(SIZE_32, 0x81, ALU_ADD, HostRegister(RAX));
+	Dword(TIMER_FREQUENCY * pendingCycles);
+	EmitModRM(SIZE_32, 0x81, ALU_CMP, HostRegister(RAX));
+	Dword(instructionsPerSecond);
+	size_t noTick = JumpIf(CONDITION_BELOW);
+
+	size_t tick = code.size();
+	EmitModRM(SIZE_32, 0x81, ALU_SUB, HostRegister(RAX));
+	Dword(instructionsPerSecond);
+
+	const int timers[] = { STATE_OFFSET(delayTimer), STATE_OFFSET(soundTimer) };
+	for (int timer : timers)
+	{
+		EmitModRM(SIZE_8, 0x80, ALU_CMP, StateMemory(timer));
+		Byte(0);
+		size_t stopped = JumpIf(CONDITION_EQUAL);
+		EmitModRM(SIZE_8, 0x80, ALU_SUB, StateMemory(timer));
+		Byte(1);
+		Bind(stopped);
+	}
+
+	EmitModRM(SIZE_32, 0x81, ALU_CMP, HostRegister(RAX));
+	Dword(instructionsPerSecond);
+	JumpBackIf(CONDITION_NOT_BELOW, tick);
+
+	Bind(noTick);
+	EmitModRM(SIZE_32, 0x89, RAX, StateMemory(STATE_OFFSET(timerPhase)));
+	pendingCycles = 0;
+}
+
+void JitCompiler::EmitWriteBack()
+{
+	for (int i = 0; i < NUM_REGISTERS; ++i)
+	{
+		if (dirty[i])
+		{
+			EmitModRM(SIZE_8, 0x88, hostRegister[i], StateMemory(STATE_OFFSET(V) + i));
+			dirty[i] = false;
+		}
+	}
+
+	if (dirtyI)
+	{
+		EmitModRM(SIZE_16, 0x89, I_REGISTER, StateMemory(STATE_OFFSET(I)));
+		dirtyI = false;
+	}
+}
+
+void JitCompiler::EmitReload()
+{
+	for (int i = 0; i < NUM_REGISTERS; ++i)
+		if (hostRegister[i] >= 0)
+			EmitModRM(SIZE_8, 0x0FB6, hostRegister[i], StateMemory(STATE_OFFSET(V) + i));
+
+	EmitModRM(SIZE_32, 0x0FB7, I_REGISTER, StateMemory(STATE_OFFSET(I)));
+}
+
+JitCompiler::Operand JitCompiler::HostRegister(int reg)
+{
+	Operand operand = { reg, -1, 1, 0 };
+	return operand;
+}
+
+JitCompiler::Operand JitCompiler::StateMemory(int offset, int index, int scale)
+{
+	Operand operand = { -1, index, scale, offset };
+	return operand;
+}
+
+JitCompiler::Operand JitCompiler::RegisterV(unsigned int i) const
+{
+	return (hostRegister[i] >= 0) ? HostRegister(hostRegister[i]) : StateMemory(STATE_OFFSET(V) + i);
+}
+
+void JitCompiler::Written(unsigned int i)
+{
+	if (hostRegister[i] >= 0)
+		dirty[i] = true;
+}
+
+void JitCompiler::Byte(unsigned int value)
+{
+	code.push_back((unsigned char)value);
+}
+
+void JitCompiler::Dword(uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		Byte(value >> (i * 8));
+}
+
+/* Emits instruction with ModRM operand. Opcodes over 0xFF are two byte 0F xx ones, reg is
+ * register or opcode extension. Size is size of rm operand, it selects 66 and REX.W prefixes. */
+void JitCompiler::EmitModRM(int size, unsigned int opcode, int reg, const Operand& rm)
+{
+	if (size == SIZE_16)
+		Byte(0x66);
+
+	unsigned int rex = (size == SIZE_64) ? 0x48 : 0;
+	if (reg & 8)
+		rex |= 0x44;
+	if (rm.reg >= 0 && (rm.reg & 8))
+		rex |= 0x41;
+	if (rm.reg < 0 && rm.index >= 0 && (rm.index & 8))
+		rex |= 0x42;
+
+	// Without REX byte registers 4 - 7 are AH - BH instead of SPL - DIL
+	if (size == SIZE_8 && ((reg >= RSP && reg <= RDI) || (rm.reg >= RSP && rm.reg <= RDI)))
+		rex |= 0x40;
+
+	if (rex != 0)
+		Byte(rex);
+
+	if (opcode > 0xFF)
+		Byte(opcode >> 8);
+	Byte(opcode & 0xFF);
+
+	if (rm.reg >= 0)
+	{
+		Byte(0xC0 | (reg & 7) << 3 | (rm.reg & 7));
+	}
+	else if (rm.index < 0)
+	{
+		Byte(0x80 | (reg & 7) << 3 | STATE_REGISTER);
+		Dword(rm.offset);
+	}
+	else
+	{
+		Byte(0x84 | (reg & 7) << 3);
+		Byte(((rm.scale == 2) ? 0x40 : 0x00) | (rm.index & 7) << 3 | STATE_REGISTER);
+		Dword(rm.offset);
+	}
+}
+
+void JitCompiler::MoveImmediate(int reg, uint32_t value)
+{
+	if (reg & 8)
+		Byte(0x41);
+	Byte(0xB8 + (reg & 7));
+	Dword(value);
+}
+
+void JitCompiler::MoveImmediate64(int reg, uint64_t value)
+{
+	Byte((reg & 8) ? 0x49 : 0x48);
+	Byte(0xB8 + (reg & 7));
+	Dword((uint32_t)value);
+	Dword((uint32_t)(value >> 32));
+}
+
+/* Emits forward jump, returns its position for Bind. */
+size_t JitCompiler::JumpIf(int condition)
+{
+	Byte(0x0F);
+	Byte(0x80 + condition);
+	Dword(0);
+	return code.size();
+}
+
+void JitCompiler::JumpBackIf(int condition, size_t target)
+{
+	Byte(0x0F);
+	Byte(0x80 + condition);
+	Dword((uint32_t)(target - (code.size() + 4)));
+}
+
+/* Points forward jump to current position. */
+void JitCompiler::Bind(size_t jump)
+{
+	uint32_t distance = (uint32_t)(code.size() - jump);
+	memcpy(&code[jump - 4], &distance, 4);
+}
+
+#else
+
+// No native code, Chip8::SetEngine runs block engine instead
+
+JitCompiler::JitCompiler()
+	: codeMemory(nullptr), codeUsed(0), pendingCycles(0), instructionsPerSecond(0), exitAddress(0)
+{
+}
+
+JitCompiler::~JitCompiler()
+{
+}
+
+bool JitCompiler::Valid() const
+{
+	return false;
+}
+
+void JitCompiler::Compile(Chip8&, unsigned short, unsigned int)
+{
+}
+
+JitBlock JitCompiler::Block(unsigned short) const
+{
+	return nullptr;
+}
+
+#endif
\ No newline at end of file
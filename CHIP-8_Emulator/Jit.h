@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Cpu.h"
+
+// Native code is generated only for x86-64, other builds (Win32 too) run ENGINE_JIT as block engine
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_X64
+#endif
+
+#define JIT_CODE_SIZE        (1 << 20)					// executable memory for blocks, all blocks are dropped when it's full
+#define JIT_PAGE_SIZE        4096						// granularity of memory protection, JIT_CODE_SIZE is a multiple of it
+#define JIT_CACHED_REGISTERS 9							// V registers one block can keep in host registers
+
+// Native code of one block. Runs whole block on state of chip and leaves pc at next instruction.
+typedef void (*JitBlock)(MachineState* state, Chip8* chip);
+
+/* Compiles basic blocks made by Chip8::BuildBlock to x86-64 code. Inside a block pc is known
+ * at every instruction, so it's stored only on exit. I stays in a host register for the whole
+ * block, V registers the block uses most are loaded to host registers on entry and written back
+ * on exit. Timers are brought up to date in one step before instructions which use them and on
+ * exit, that gives the same state as updating them after every instruction. DXYN, CXNN, 00E0,
+ * FX0A, FX33, FX55 and unknown opcodes are left to handlers of the dispatch table, the last four
+ * end the block. Blocks live while their code does, see Chip8::InvalidateCode. */
+class JitCompiler
+{
+public:
+	JitCompiler();
+	~JitCompiler();
+
+	bool Valid() const;
+	void Compile(Chip8& chip, unsigned short start, unsigned int length);
+	JitBlock Block(unsigned short start) const;
+
+private:
+	// Operand of x86 instruction, host register or byte in machine state at [state + index * scale + offset]
+	struct Operand
+	{
+		int reg;										// -1 for memory
+		int index;										// -1 for no index register
+		int scale;
+		int offset;
+	};
+
+	// Where pc of next instruction is when block exits
+	enum BlockExit
+	{
+		EXIT_NONE,										// block continues with next instruction
+		EXIT_CONSTANT,									// exitAddress
+		EXIT_EDX,
+		EXIT_STATE										// already stored by handler
+	};
+
+	void Flush(Chip8& chip);
+	void AllocateRegisters(const Chip8& chip, unsigned short start, unsigned int length);
+	BlockExit EmitInstruction(const Chip8::DecodedInstruction& instr, unsigned short address);
+	BlockExit EmitArithmetic(const Chip8::DecodedInstruction& instr);
+	BlockExit EmitSkip(int condition, unsigned short address);
+	void EmitInterpreted(unsigned short opcode, unsigned short address, bool endsBlock);
+	void EmitPrologue();
+	void EmitExit(BlockExit exit);
+	void EmitSyncTimers();
+	void EmitWriteBack();
+	void EmitReload();
+
+	static Operand HostRegister(int reg);
+	static Operand StateMemory(int offset, int index = -1, int scale = 1);
+	Operand RegisterV(unsigned int i) const;
+	void Written(unsigned int i);
+
+	// x86-64 encoding
+	void Byte(unsigned int value);
+	void Dword(uint32_t value);
+	void EmitModRM(int size, unsigned int opcode, int reg, const Operand& rm);
+	void MoveImmediate(int reg, uint32_t value);
+	void MoveImmediate64(int reg, uint64_t value);
+	size_t JumpIf(int condition);
+	void JumpBackIf(int condition, size_t target);
+	void Bind(size_t jump);
+
+	unsigned char* codeMemory;							// nullptr if native code isn't available
+	size_t codeUsed;
+	JitBlock blocks[MEMORY_SIZE];						// valid only where Chip8::blockLength isn't 0
+	std::vector<unsigned char> code;					// block being compiled, copied to codeMemory when done
+
+	// State of block being compiled
+	int hostRegister[NUM_REGISTERS];					// host register of V register, -1 if it's used from memory
+	bool dirty[NUM_REGISTERS];							// host register holds value not written back yet
+	bool dirtyI;
+	std::vector<int> savedRegisters;					// callee-saved host registers the block pushes
+	unsigned int pendingCycles;							// executed instructions timers don't know about yet
+	unsigned int instructionsPerSecond;
+	unsigned short exitAddress;
+};
\ No newline at end of file
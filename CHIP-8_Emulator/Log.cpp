@@ -0,0 +1,21 @@
+#include "Log.h"
+#include <iostream>
+#include <mutex>
+
+LogLevel logLevel = LOG_LEVEL_INFO;
+
+static std::mutex logMutex;								// batch runs log from many threads
+
+/* Sets level of messages which are written. Levels above MAX_LOG_LEVEL stay disabled. */
+void SetLogLevel(LogLevel level)
+{
+	logLevel = level;
+}
+
+/* Logs message to console. Use LOG_* macros, they skip building the message when it's not needed.
+ * Console isn't flushed after every message, that would limit emulation to speed of terminal. */
+void Log(const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	std::cout << message << '\n';
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+enum LogLevel
+{
+	LOG_LEVEL_NONE,
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_TRACE										// every executed instruction
+};
+
+// Messages above this level are compiled out. Release builds drop trace logs.
+#ifndef MAX_LOG_LEVEL
+#ifdef NDEBUG
+#define MAX_LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define MAX_LOG_LEVEL LOG_LEVEL_TRACE
+#endif
+#endif
+
+// Message expression is evaluated only if level is enabled
+#define LOG(level, message) \
+	do { if ((level) <= MAX_LOG_LEVEL && (level) <= logLevel) Log(message); } while (0)
+
+#define LOG_ERROR(message)   LOG(LOG_LEVEL_ERROR, message)
+#define LOG_WARNING(message) LOG(LOG_LEVEL_WARNING, message)
+#define LOG_INFO(message)    LOG(LOG_LEVEL_INFO, message)
+#define LOG_TRACE(message)   LOG(LOG_LEVEL_TRACE, message)
+
+extern LogLevel logLevel;								// runtime level, LOG_LEVEL_INFO by default
+
+void SetLogLevel(LogLevel level);
+void Log(const std::string& message);
\ No newline at end of file
@@ -1,30 +1,430 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include "BatchRunner.h"
 #include "Cpu.h"
+#include "Headless.h"
+#include "Log.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "VideoCapture.h"
+
+#ifdef CHIP8_TRANSLATED_ROM
+extern const TranslatedProgram translatedProgram; // generated by CHIP-8_Translator
+#endif
+
+/* Parses RRGGBB hex color. */
+static bool ParseColor(const std::string& text, uint32_t& color)
+{
+	char* end = nullptr;
+	unsigned long value = strtoul(text.c_str(), &end, 16);
+	if (text.size() != 6 || *end != '\0')
+		return false;
+
+	color = MakeColor((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF);
+	return true;
+}
 
 int main(int argc, char* argv[])
 {
-	if (argc > 2)
+	Chip8 chip;
+	Chip8::InterpreterEngine engine = Chip8::ENGINE_DECODE_CACHE;
+	Chip8::PresentMode presentMode = Chip8::PRESENT_FRAME;
+	std::string inputRomFile = "";
+	std::string traceFile = "";
+	std::string profileFile = "";
+	std::string inputScript = "";
+	std::string batchPath = "";
+	std::string recordFile = "";
+	std::string replayFile = "";
+	std::string captureFile = "";
+	std::string exportSource = "";
+	std::string exportFile = "";
+	unsigned int batchThreads = 0;
+	unsigned int instructionsPerSecond = DEFAULT_INSTRUCTIONS_PER_SECOND;
+	bool headless = false;
+	bool verifyEngine = false;
+	bool idleSkipping = true;
+	bool seeded = false;
+	Palette palette = DefaultPalette();
+	unsigned int seed = 0;
+
+	ScaleOptions scaleOptions = DefaultScaleOptions();
+
+	HeadlessOptions headlessOptions;
+	headlessOptions.frames = 0;
+	headlessOptions.maxCycles = 0;
+
+	for (int i = 1; i < argc; ++i)
 	{
-		Log("Wrong number of command line arguments.");
-		return 0;
+		std::string arg = argv[i];
+
+		if (arg == "--engine" && i + 1 < argc)
+		{
+			std::string engineName = argv[++i];
+
+			if (engineName == "cache")
+				engine = Chip8::ENGINE_DECODE_CACHE;
+			else if (engineName == "table")
+				engine = Chip8::ENGINE_DISPATCH_TABLE;
+			else if (engineName == "block")
+				engine = Chip8::ENGINE_BLOCK_CACHE;
+			else if (engineName == "jit")
+				engine = Chip8::ENGINE_JIT;
+#ifdef CHIP8_TRANSLATED_ROM
+			else if (engineName == "translated")
+				engine = Chip8::ENGINE_TRANSLATED;
+#endif
+			else
+			{
+				LOG_ERROR("Unknown engine: " + engineName);
+				return 0;
+			}
+		}
+		else if (arg == "--log-level" && i + 1 < argc)
+		{
+			std::string levelName = argv[++i];
+
+			if (levelName == "none")
+				SetLogLevel(LOG_LEVEL_NONE);
+			else if (levelName == "error")
+				SetLogLevel(LOG_LEVEL_ERROR);
+			else if (levelName == "warning")
+				SetLogLevel(LOG_LEVEL_WARNING);
+			else if (levelName == "info")
+				SetLogLevel(LOG_LEVEL_INFO);
+			else if (levelName == "trace")
+				SetLogLevel(LOG_LEVEL_TRACE);
+			else
+			{
+				LOG_ERROR("Unknown log level: " + levelName);
+				return 0;
+			}
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			traceFile = argv[++i];
+		}
+		else if (arg == "--profile" && i + 1 < argc)
+		{
+			profileFile = argv[++i];
+		}
+		else if ((arg == "--foreground" || arg == "--background") && i + 1 < argc)
+		{
+			uint32_t& color = (arg == "--foreground") ? palette.foreground : palette.background;
+			if (!ParseColor(argv[++i], color))
+			{
+				LOG_ERROR("Color has to be RRGGBB hex number: " + std::string(argv[i]));
+				return 0;
+			}
+		}
+		else if (arg == "--present" && i + 1 < argc)
+		{
+			std::string modeName = argv[++i];
+
+			if (modeName == "immediate")
+				presentMode = Chip8::PRESENT_IMMEDIATE;
+			else if (modeName == "frame")
+				presentMode = Chip8::PRESENT_FRAME;
+			else if (modeName == "vblank")
+				presentMode = Chip8::PRESENT_VBLANK;
+			else
+			{
+				LOG_ERROR("Unknown present mode: " + modeName);
+				return 0;
+			}
+		}
+		else if (arg == "--scale" && i + 1 < argc)
+		{
+			scaleOptions.factor = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--filter" && i + 1 < argc)
+		{
+			std::string filterName = argv[++i];
+
+			if (filterName == "nearest")
+				scaleOptions.filter = SCALE_NEAREST;
+			else if (filterName == "epx")
+				scaleOptions.filter = SCALE_EPX;
+			else
+			{
+				LOG_ERROR("Unknown filter: " + filterName);
+				return 0;
+			}
+		}
+		else if (arg == "--scanlines")
+		{
+			scaleOptions.scanlines = true;
+		}
+		else if (arg == "--headless")
+		{
+			headless = true;
+		}
+		else if (arg == "--no-idle-skip")
+		{
+			idleSkipping = false;
+		}
+		else if (arg == "--verify-engine")
+		{
+			verifyEngine = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			headlessOptions.frames = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--cycles" && i + 1 < argc)
+		{
+			headlessOptions.maxCycles = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--input" && i + 1 < argc)
+		{
+			inputScript = argv[++i];
+		}
+		else if (arg == "--ips" && i + 1 < argc)
+		{
+			instructionsPerSecond = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--seed" && i + 1 < argc)
+		{
+			seed = strtoul(argv[++i], nullptr, 10);
+			seeded = true;
+		}
+		else if (arg == "--record" && i + 1 < argc)
+		{
+			recordFile = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc)
+		{
+			replayFile = argv[++i];
+		}
+		else if (arg == "--capture" && i + 1 < argc)
+		{
+			captureFile = argv[++i];
+		}
+		else if (arg == "--export-video" && i + 2 < argc)
+		{
+			exportSource = argv[++i];
+			exportFile = argv[++i];
+		}
+		else if (arg == "--batch" && i + 1 < argc)
+		{
+			batchPath = argv[++i];
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			batchThreads = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg.compare(0, 2, "--") == 0 || !inputRomFile.empty())
+		{
+			LOG_ERROR("Wrong command line arguments.");
+			return 0;
+		}
+		else
+		{
+			inputRomFile = arg;
+		}
 	}
 
-	Chip8 chip;
-	std::string inputRomFile = "";
+	if (!batchPath.empty())
+	{
+		BatchOptions batchOptions;
+		batchOptions.threads = batchThreads;
+		batchOptions.engine = engine;
+		batchOptions.instructionsPerSecond = instructionsPerSecond;
+		batchOptions.seeded = seeded;
+		batchOptions.seed = seed;
+		batchOptions.idleSkipping = idleSkipping;
+#ifdef CHIP8_TRANSLATED_ROM
+		batchOptions.translatedProgram = &translatedProgram;
+#else
+		batchOptions.translatedProgram = nullptr;
+#endif
+		batchOptions.run = headlessOptions;
+
+		if (!inputScript.empty() && !LoadInputScript(inputScript, batchOptions.run.input))
+			return 1;
+
+		if (batchOptions.run.frames == 0 && batchOptions.run.maxCycles == 0)
+			batchOptions.run.frames = DEFAULT_HEADLESS_FRAMES;
 
-	if (argc == 2)
+		std::vector<std::string> romPaths;
+		if (!ListROMs(batchPath, romPaths))
+			return 1;
+
+		return RunBatch(romPaths, batchOptions) ? 0 : 1;
+	}
+
+	// Replay is headless run with everything else taken from movie
+	Movie movie;
+	if (!replayFile.empty())
 	{
-		inputRomFile = argv[1];
+		if (!LoadMovie(replayFile, movie))
+			return 1;
+
+		headless = true;
+		instructionsPerSecond = movie.instructionsPerSecond;
+		headlessOptions.frames = movie.frames;
+		headlessOptions.maxCycles = 0;
+		headlessOptions.input = movie.input;
+		inputScript = "";
 	}
-	else
+
+	if (!recordFile.empty() && headless)
+	{
+		LOG_ERROR("Only sessions with window can be recorded, headless runs are reproduced with --input.");
+		return 1;
+	}
+
+	if (!Upscaler::ValidOptions(scaleOptions))
 	{
+		LOG_ERROR("Scale has to be 1 - " + std::to_string(MAX_SCALE_FACTOR) + ", even with EPX filter.");
+		return 1;
+	}
+
+	// Export needs only capture file, no ROM
+	if (!exportSource.empty())
+		return ExportVideo(exportSource, exportFile, scaleOptions, palette) ? 0 : 1;
+
+	if (inputRomFile.empty())
+	{
+		// There's nobody to ask in headless mode
+		if (headless || verifyEngine)
+		{
+			LOG_ERROR("ROM file is required in headless mode.");
+			return 1;
+		}
+
 		std::cout << "Enter name of input ROM file: ";
 		std::cin >> inputRomFile;
 	}
 
-	chip.LoadROM(inputRomFile);
-	chip.MainLoop();
+	if (!chip.LoadROM(inputRomFile))
+		return 1;
+
+#ifdef CHIP8_TRANSLATED_ROM
+	chip.SetTranslatedProgram(&translatedProgram);
+#endif
+	chip.SetEngine(engine);
+	chip.SetInstructionsPerSecond(instructionsPerSecond);
+	chip.SetIdleSkipping(idleSkipping);
+	chip.SetPalette(palette);
+	chip.SetPresentMode(presentMode);
+	chip.SetScaleOptions(scaleOptions);
+	if (seeded)
+		chip.SetRandomSeed(seed);
+
+	unsigned int romHash = 0;
+	if ((!replayFile.empty() || !recordFile.empty()) && !HashROMFile(inputRomFile, romHash))
+		return 1;
+
+	if (!replayFile.empty())
+	{
+		if (romHash != movie.romHash)
+		{
+			LOG_ERROR("Movie was recorded with different ROM.");
+			return 1;
+		}
+
+		chip.SetRandomSeed(movie.seed);
+	}
+
+	if (verifyEngine)
+	{
+		if (!inputScript.empty() && !LoadInputScript(inputScript, headlessOptions.input))
+			return 1;
+
+		if (headlessOptions.frames == 0)
+			headlessOptions.frames = DEFAULT_HEADLESS_FRAMES;
+
+		// Reference is decode cache interpreter with the same ROM, speed and seed, running every
+		// instruction, so idle loop skipping of tested engine is checked too
+		std::unique_ptr<Chip8> reference(new Chip8());
+		if (!reference->LoadROM(inputRomFile))
+			return 1;
+
+		reference->SetInstructionsPerSecond(instructionsPerSecond);
+		reference->SetIdleSkipping(false);
+		reference->SetRandomSeed(chip.RandomSeed());
+		return (CompareEngines(*reference, chip, headlessOptions) == 0) ? 0 : 1;
+	}
+
+	Tracer tracer;
+	if (!traceFile.empty() && tracer.Start(traceFile))
+		chip.SetTracer(&tracer);
+
+	// Allocated only when asked for, counters take about half a megabyte
+	std::unique_ptr<Profiler> profiler;
+	if (!profileFile.empty())
+	{
+		profiler.reset(new Profiler());
+		chip.SetProfiler(profiler.get());
+	}
+
+	// Encoder thread runs only while capturing
+	std::unique_ptr<VideoCapture> capture;
+	if (!captureFile.empty())
+	{
+		capture.reset(new VideoCapture());
+		if (!capture->Start(captureFile))
+			return 1;
+
+		chip.SetVideoCapture(capture.get());
+	}
+
+	if (headless)
+	{
+		if (!inputScript.empty() && !LoadInputScript(inputScript, headlessOptions.input))
+			return 1;
+
+		// Replay runs exactly recorded frames, even none
+		if (headlessOptions.frames == 0 && headlessOptions.maxCycles == 0 && replayFile.empty())
+			headlessOptions.frames = DEFAULT_HEADLESS_FRAMES;
+
+		HeadlessResult result = RunHeadless(chip, headlessOptions);
+		PrintResult(result);
+
+		if (!replayFile.empty() && result.framebufferHash != movie.framebufferHash)
+		{
+			LOG_ERROR("Replay doesn't match recording, framebuffer at the end differs.");
+			chip.SetTracer(nullptr);
+			tracer.Stop();
+			return 1;
+		}
+	}
+	else if (!recordFile.empty())
+	{
+		movie.seed = chip.RandomSeed();
+		movie.instructionsPerSecond = chip.InstructionsPerSecond();
+		movie.romHash = romHash;
+		movie.frames = 0;
+
+		chip.SetMovie(&movie);
+		chip.MainLoop();
+		chip.SetMovie(nullptr);
+
+		movie.framebufferHash = chip.FramebufferHash();
+		SaveMovie(recordFile, movie);
+	}
+	else
+	{
+		chip.MainLoop();
+	}
+
+	chip.SetTracer(nullptr);
+	tracer.Stop();
+
+	if (capture)
+	{
+		chip.SetVideoCapture(nullptr);
+		capture->Stop();
+	}
+
+	if (profiler)
+	{
+		chip.SetProfiler(nullptr);
+		profiler->WriteReport(profileFile);
+		profiler->WriteCollapsedStacks(profileFile + ".folded");
+	}
 
 	return 0;
 }
\ No newline at end of file
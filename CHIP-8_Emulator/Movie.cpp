@@ -0,0 +1,115 @@
+#include "Movie.h"
+#include "Log.h"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+/* Hash of ROM file, replay checks it to make sure movie is played on the same ROM. */
+bool HashROMFile(const std::string& romPath, unsigned int& hash)
+{
+	std::ifstream romFile(romPath, std::ios_base::binary);
+	if (!romFile)
+	{
+		LOG_ERROR("Error (movie): Can't open " + romPath);
+		return false;
+	}
+
+	std::vector<unsigned char> rom((std::istreambuf_iterator<char>(romFile)), std::istreambuf_iterator<char>());
+	hash = Chip8::HashBytes(rom.data(), (unsigned int)rom.size());
+	return true;
+}
+
+/* Writes movie as text. After header lines key events follow in input script format,
+ * so events can be edited by hand or cut out to input script. */
+bool SaveMovie(const std::string& moviePath, const Movie& movie)
+{
+	std::ofstream movieFile(moviePath);
+	if (!movieFile)
+	{
+		LOG_ERROR("Error (movie): Can't open " + moviePath);
+		return false;
+	}
+
+	movieFile << MOVIE_HEADER << "\n";
+	movieFile << "seed " << movie.seed << "\n";
+	movieFile << "ips " << movie.instructionsPerSecond << "\n";
+	movieFile << std::hex << std::uppercase;
+	movieFile << "rom " << movie.romHash << "\n";
+	movieFile << "framebuffer " << movie.framebufferHash << "\n";
+	movieFile << std::dec;
+	movieFile << "frames " << movie.frames << "\n";
+
+	for (const KeyEvent& event : movie.input)
+		movieFile << event.frame << " " << std::hex << std::uppercase << (unsigned int)event.key << std::dec << " " << (unsigned int)event.state << "\n";
+
+	if (!movieFile)
+	{
+		LOG_ERROR("Error (movie): Can't write " + moviePath);
+		return false;
+	}
+
+	LOG_INFO("Movie saved to " + moviePath);
+	return true;
+}
+
+/* Reads movie written by SaveMovie. */
+bool LoadMovie(const std::string& moviePath, Movie& movie)
+{
+	std::ifstream movieFile(moviePath);
+	if (!movieFile)
+	{
+		LOG_ERROR("Error (movie): Can't open " + moviePath);
+		return false;
+	}
+
+	std::string line;
+	if (!std::getline(movieFile, line) || line != MOVIE_HEADER)
+	{
+		LOG_ERROR("Error (movie): " + moviePath + " is not a movie file");
+		return false;
+	}
+
+	movie.seed = 0;
+	movie.instructionsPerSecond = DEFAULT_INSTRUCTIONS_PER_SECOND;
+	movie.romHash = 0;
+	movie.frames = 0;
+	movie.framebufferHash = 0;
+	movie.input.clear();
+
+	for (int lineNumber = 2; std::getline(movieFile, line); ++lineNumber)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream fields(line);
+		std::string name;
+		fields >> name;
+
+		bool valid = true;
+		if (name == "seed")
+			valid = !!(fields >> movie.seed);
+		else if (name == "ips")
+			valid = !!(fields >> movie.instructionsPerSecond);
+		else if (name == "rom")
+			valid = !!(fields >> std::hex >> movie.romHash);
+		else if (name == "framebuffer")
+			valid = !!(fields >> std::hex >> movie.framebufferHash);
+		else if (name == "frames")
+			valid = !!(fields >> movie.frames);
+		else
+		{
+			KeyEvent event;
+			valid = ParseKeyEvent(line, event) && (movie.input.empty() || movie.input.back().frame <= event.frame);
+			if (valid)
+				movie.input.push_back(event);
+		}
+
+		if (!valid)
+		{
+			LOG_ERROR("Error (movie): Bad line " + std::to_string(lineNumber) + " in " + moviePath);
+			return false;
+		}
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Headless.h"
+
+#define MOVIE_HEADER "# CHIP-8 movie 1"				// first line of every movie file
+
+// Everything needed to replay a session bit for bit: random seed, speed and key changes
+// stamped with 60 Hz frame of emulated time they were applied in
+struct Movie
+{
+	unsigned int seed;									// Chip8::RandomSeed of recorded session
+	unsigned int instructionsPerSecond;
+	unsigned int romHash;								// Chip8::HashBytes of ROM file
+	unsigned int frames;								// length of recording
+	unsigned int framebufferHash;						// screen at the end of recording
+	std::vector<KeyEvent> input;						// sorted by frame
+};
+
+bool HashROMFile(const std::string& romPath, unsigned int& hash);
+bool SaveMovie(const std::string& moviePath, const Movie& movie);
+bool LoadMovie(const std::string& moviePath, Movie& movie);
\ No newline at end of file
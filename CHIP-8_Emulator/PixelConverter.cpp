@@ -0,0 +1,180 @@
+#include "PixelConverter.h"
+#include "Log.h"
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PIXEL_CONVERTER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles any intrinsic as is, GCC and Clang need AVX2 enabled per function
+#if defined(PIXEL_CONVERTER_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+#define ROW_PIXELS 64
+
+/* Packs color to 4 bytes in memory order R, G, B, A, alpha is always opaque. */
+uint32_t MakeColor(unsigned char red, unsigned char green, unsigned char blue)
+{
+	unsigned char bytes[4] = { red, green, blue, 255 };
+
+	uint32_t color;
+	memcpy(&color, bytes, sizeof(color));
+	return color;
+}
+
+/* White pixels on black background. */
+Palette DefaultPalette()
+{
+	Palette palette;
+	palette.foreground = MakeColor(255, 255, 255);
+	palette.background = MakeColor(0, 0, 0);
+	return palette;
+}
+
+/* Reference conversion, one pixel at a time. Vector versions give exactly the same bytes. */
+void ConvertRowsScalar(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba)
+{
+	for (unsigned int y = 0; y < rowCount; ++y)
+	{
+		uint64_t row = rows[y];
+		for (int x = 0; x < ROW_PIXELS; ++x, rgba += 4)
+		{
+			uint32_t color = ((row << x) & 0x8000000000000000ull) ? palette.foreground : palette.background;
+			memcpy(rgba, &color, sizeof(color));
+		}
+	}
+}
+
+#ifdef PIXEL_CONVERTER_X86
+
+/* 4 pixels per store. Every byte of row is broadcast, masked with one bit per lane and
+ * compared, lanes with bit set take foreground color. */
+TARGET_SSE2 void ConvertRowsSSE2(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba)
+{
+	const __m128i foreground = _mm_set1_epi32((int)palette.foreground);
+	const __m128i background = _mm_set1_epi32((int)palette.background);
+	const __m128i highBits   = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);		// leftmost pixel in lane 0
+	const __m128i lowBits    = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+
+	for (unsigned int y = 0; y < rowCount; ++y)
+	{
+		uint64_t row = rows[y];
+		for (int shift = 56; shift >= 0; shift -= 8, rgba += 32)
+		{
+			__m128i bits = _mm_set1_epi32((int)(row >> shift) & 0xFF);
+
+			__m128i high = _mm_cmpeq_epi32(_mm_and_si128(bits, highBits), highBits);
+			__m128i low  = _mm_cmpeq_epi32(_mm_and_si128(bits, lowBits), lowBits);
+
+			_mm_storeu_si128((__m128i*)rgba,        _mm_or_si128(_mm_and_si128(high, foreground), _mm_andnot_si128(high, background)));
+			_mm_storeu_si128((__m128i*)(rgba + 16), _mm_or_si128(_mm_and_si128(low, foreground), _mm_andnot_si128(low, background)));
+		}
+	}
+}
+
+/* 8 pixels per store, same idea as SSE2 version. */
+TARGET_AVX2 void ConvertRowsAVX2(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba)
+{
+	const __m256i foreground = _mm256_set1_epi32((int)palette.foreground);
+	const __m256i background = _mm256_set1_epi32((int)palette.background);
+	const __m256i pixelBits  = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+
+	for (unsigned int y = 0; y < rowCount; ++y)
+	{
+		uint64_t row = rows[y];
+		for (int shift = 56; shift >= 0; shift -= 8, rgba += 32)
+		{
+			__m256i bits = _mm256_set1_epi32((int)(row >> shift) & 0xFF);
+			__m256i lit  = _mm256_cmpeq_epi32(_mm256_and_si256(bits, pixelBits), pixelBits);
+
+			_mm256_storeu_si256((__m256i*)rgba, _mm256_blendv_epi8(background, foreground, lit));
+		}
+	}
+}
+
+static bool CpuHasSSE2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	return __builtin_cpu_supports("sse2") != 0;
+#endif
+}
+
+/* AVX2 needs support from both CPU and OS, which has to save YMM registers on context switch. */
+static bool CpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	if (!osSavesYmm || (info[2] & (1 << 28)) == 0)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+/* Fastest conversion this CPU can run. */
+static RowConverter SelectRowConverter()
+{
+	if (CpuHasAVX2())
+	{
+		LOG_INFO("Screen conversion: AVX2");
+		return &ConvertRowsAVX2;
+	}
+
+	if (CpuHasSSE2())
+	{
+		LOG_INFO("Screen conversion: SSE2");
+		return &ConvertRowsSSE2;
+	}
+
+	LOG_INFO("Screen conversion: scalar");
+	return &ConvertRowsScalar;
+}
+
+#else
+
+// Other architectures have only scalar conversion
+void ConvertRowsSSE2(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba)
+{
+	ConvertRowsScalar(rows, rowCount, palette, rgba);
+}
+
+void ConvertRowsAVX2(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba)
+{
+	ConvertRowsScalar(rows, rowCount, palette, rgba);
+}
+
+static RowConverter SelectRowConverter()
+{
+	return &ConvertRowsScalar;
+}
+
+#endif
+
+/* Converts with the fastest version for this CPU, selected on first call. */
+void ConvertRows(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba)
+{
+	static const RowConverter converter = SelectRowConverter();
+	converter(rows, rowCount, palette, rgba);
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+// Screen colors, both stored in memory order R, G, B, A as sf::Texture expects them
+struct Palette
+{
+	uint32_t foreground;								// lit pixel
+	uint32_t background;
+};
+
+// Expands rowCount packed screen rows (leftmost pixel in highest bit) to 64 RGBA pixels each
+typedef void (*RowConverter)(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba);
+
+uint32_t MakeColor(unsigned char red, unsigned char green, unsigned char blue);
+Palette DefaultPalette();
+
+void ConvertRowsScalar(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba);
+void ConvertRowsSSE2(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba);
+void ConvertRowsAVX2(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba);
+void ConvertRows(const uint64_t* rows, unsigned int rowCount, const Palette& palette, unsigned char* rgba);
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "Profiler.h"
+#include "Disassembler.h"
+#include "Log.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+Profiler::Profiler()
+	: cycles(0), pcCounts(MEMORY_SIZE, 0), pcOpcodes(MEMORY_SIZE, 0), opcodeCounts(0x10000, 0),
+	currentPath(0), currentSp(0), currentTop(0)
+{
+	// Path of code outside of any subroutine
+	paths.push_back(std::vector<unsigned short>(1, ROM_START));
+	pathCounts.push_back(0);
+	pathIndex[paths[0]] = 0;
+}
+
+/* Counts instruction at pc, called right before it's executed. */
+void Profiler::Record(unsigned short pc, unsigned short opcode, const unsigned short* stack, unsigned char sp, const unsigned char* memory)
+{
+	++cycles;
+	++pcCounts[pc & (MEMORY_SIZE - 1)];
+	pcOpcodes[pc & (MEMORY_SIZE - 1)] = opcode;
+	++opcodeCounts[opcode];
+
+	unsigned short top = (sp > 0 && sp <= STACK_SIZE) ? stack[sp - 1] : 0;
+	if (sp != currentSp || top != currentTop)
+	{
+		currentPath = FindPath(stack, sp, memory);
+		currentSp = sp;
+		currentTop = top;
+	}
+
+	++pathCounts[currentPath];
+}
+
+/* Index of call path for current stack, new paths are added. Entry of every subroutine
+ * is target of the call instruction whose address is on stack. */
+unsigned int Profiler::FindPath(const unsigned short* stack, unsigned char sp, const unsigned char* memory)
+{
+	std::vector<unsigned short> path(1, ROM_START);
+	for (int i = 0; i < sp && i < STACK_SIZE; ++i)
+	{
+		unsigned short call = stack[i] & (MEMORY_SIZE - 1);
+		unsigned short target = (memory[call] & 0x0F) << 8 | memory[(call + 1) & (MEMORY_SIZE - 1)];
+		path.push_back(target);
+	}
+
+	auto found = pathIndex.find(path);
+	if (found != pathIndex.end())
+		return found->second;
+
+	unsigned int index = (unsigned int)paths.size();
+	paths.push_back(path);
+	pathCounts.push_back(0);
+	pathIndex[path] = index;
+	return index;
+}
+
+/* Writes hottest addresses and opcode classes, both sorted by count. */
+bool Profiler::WriteReport(const std::string& reportPath) const
+{
+	std::ofstream report(reportPath);
+	if (!report)
+	{
+		LOG_ERROR("Error (profiler): Can't open " + reportPath);
+		return false;
+	}
+
+	char line[128];
+	double percent = (cycles > 0) ? 100.0 / cycles : 0.0;
+	report << "cycles: " << cycles << "\n\n";
+
+	std::vector<unsigned short> addresses;
+	for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+		if (pcCounts[address] > 0)
+			addresses.push_back((unsigned short)address);
+
+	std::stable_sort(addresses.begin(), addresses.end(),
+		[this](unsigned short a, unsigned short b) { return pcCounts[a] > pcCounts[b]; });
+
+	snprintf(line, sizeof(line), "%-8s %14s %8s  %s\n", "address", "count", "%", "instruction");
+	report << line;
+	for (size_t i = 0; i < addresses.size() && i < PROFILE_REPORT_TOP; ++i)
+	{
+		unsigned short address = addresses[i];
+		snprintf(line, sizeof(line), "0x%03X    %14llu %7.2f%%  %04X  %s\n", address, pcCounts[address], pcCounts[address] * percent,
+			pcOpcodes[address], Disassemble(pcOpcodes[address]).c_str());
+		report << line;
+	}
+
+	std::map<std::string, unsigned long long> classCounts;
+	for (unsigned int opcode = 0; opcode < opcodeCounts.size(); ++opcode)
+		if (opcodeCounts[opcode] > 0)
+			classCounts[OpcodeClass((unsigned short)opcode)] += opcodeCounts[opcode];
+
+	std::vector<std::pair<std::string, unsigned long long>> classes(classCounts.begin(), classCounts.end());
+	std::stable_sort(classes.begin(), classes.end(),
+		[](const std::pair<std::string, unsigned long long>& a, const std::pair<std::string, unsigned long long>& b) { return a.second > b.second; });
+
+	snprintf(line, sizeof(line), "\n%-8s %14s %8s\n", "opcode", "count", "%");
+	report << line;
+	for (const auto& opcodeClass : classes)
+	{
+		snprintf(line, sizeof(line), "%-8s %14llu %7.2f%%\n", opcodeClass.first.c_str(), opcodeClass.second, opcodeClass.second * percent);
+		report << line;
+	}
+
+	if (!report)
+	{
+		LOG_ERROR("Error (profiler): Can't write " + reportPath);
+		return false;
+	}
+
+	LOG_INFO("Profile written to " + reportPath);
+	return true;
+}
+
+/* Writes one "0x200;0x2A4;0x31C <count>" line per call path, input for flamegraph.pl and similar tools. */
+bool Profiler::WriteCollapsedStacks(const std::string& stacksPath) const
+{
+	std::ofstream stacks(stacksPath);
+	if (!stacks)
+	{
+		LOG_ERROR("Error (profiler): Can't open " + stacksPath);
+		return false;
+	}
+
+	char frame[8];
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		if (pathCounts[i] == 0)
+			continue;
+
+		for (size_t j = 0; j < paths[i].size(); ++j)
+		{
+			snprintf(frame, sizeof(frame), (j == 0) ? "0x%03X" : ";0x%03X", paths[i][j]);
+			stacks << frame;
+		}
+
+		stacks << " " << pathCounts[i] << "\n";
+	}
+
+	if (!stacks)
+	{
+		LOG_ERROR("Error (profiler): Can't write " + stacksPath);
+		return false;
+	}
+
+	return true;
+}
\ No newline at end of file
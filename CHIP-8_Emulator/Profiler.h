@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Cpu.h"
+
+#define PROFILE_REPORT_TOP 40							// hottest addresses listed in report
+
+/* Counts executed instructions per address, per opcode and per call path. Chip8 calls Record
+ * for every cycle while profiler is set, see Chip8::SetProfiler. Call path is made of entry
+ * addresses of subroutines on emulated stack, written as collapsed stacks for flamegraph tools. */
+class Profiler
+{
+public:
+	Profiler();
+
+	void Record(unsigned short pc, unsigned short opcode, const unsigned short* stack, unsigned char sp, const unsigned char* memory);
+	bool WriteReport(const std::string& reportPath) const;
+	bool WriteCollapsedStacks(const std::string& stacksPath) const;
+
+private:
+	unsigned int FindPath(const unsigned short* stack, unsigned char sp, const unsigned char* memory);
+
+	unsigned long long cycles;
+	std::vector<unsigned long long> pcCounts;			// per address
+	std::vector<unsigned short> pcOpcodes;				// opcode last executed at address
+	std::vector<unsigned long long> opcodeCounts;		// per opcode, grouped to classes in report
+	std::vector<unsigned long long> pathCounts;			// per call path
+	std::vector<std::vector<unsigned short>> paths;		// subroutine entries from ROM_START down
+	std::map<std::vector<unsigned short>, unsigned int> pathIndex;
+
+	// Stack changes only on calls and returns, path is looked up again only then
+	unsigned int currentPath;
+	unsigned char currentSp;
+	unsigned short currentTop;
+};
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+#define RANDOM_ZERO_SEED_STATE 0x6D2B79F5u				// xorshift state must never be zero
+
+/* Small and fast xorshift32 generator. Plain data, so it's part of MachineState and is saved,
+ * restored and rewound together with the rest of the machine. */
+struct XorShiftRandom
+{
+	uint32_t state;
+
+	/* Same seed always gives the same sequence. Seed is mixed first, so close seeds don't
+	 * start with similar numbers. */
+	void Seed(uint32_t seed)
+	{
+		seed = (seed ^ (seed >> 16)) * 0x45D9F3Bu;
+		seed = (seed ^ (seed >> 16)) * 0x45D9F3Bu;
+		seed = seed ^ (seed >> 16);
+
+		state = (seed != 0) ? seed : RANDOM_ZERO_SEED_STATE;
+	}
+
+	uint32_t Next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+};
\ No newline at end of file
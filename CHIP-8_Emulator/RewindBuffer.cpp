@@ -0,0 +1,166 @@
+#include "RewindBuffer.h"
+#include <cstring>
+
+#define MAX_RUN 0xFFFF									// runs are stored as 16-bit counts
+
+RewindBuffer::RewindBuffer(unsigned int maxFrames, size_t maxBytes)
+	: maxFrames(maxFrames), maxBytes(maxBytes), bytes(0), sinceKeyframe(0)
+{
+}
+
+/* Adds state of newest frame. */
+void RewindBuffer::Push(const MachineState& state)
+{
+	Frame frame;
+	frame.keyframe = (frames.empty() || sinceKeyframe + 1 >= REWIND_KEYFRAME_INTERVAL);
+
+	if (frame.keyframe)
+	{
+		Compress((const unsigned char*)&state, sizeof(state), frame.data);
+		sinceKeyframe = 0;
+	}
+	else
+	{
+		unsigned char delta[sizeof(MachineState)];
+		const unsigned char* previous = (const unsigned char*)&newest;
+		const unsigned char* current  = (const unsigned char*)&state;
+		for (size_t i = 0; i < sizeof(MachineState); ++i)
+			delta[i] = previous[i] ^ current[i];
+
+		Compress(delta, sizeof(delta), frame.data);
+		++sinceKeyframe;
+	}
+
+	bytes += frame.data.size();
+	frames.push_back(std::move(frame));
+	newest = state;
+
+	while (frames.size() > maxFrames || bytes > maxBytes)
+	{
+		size_t framesBefore = frames.size();
+		DropOldestGroup();
+		if (frames.size() == framesBefore)
+			break;
+	}
+}
+
+/* Drops newest frame and returns state of frame before it. Returns false if there is no
+ * older frame, state is unchanged then. */
+bool RewindBuffer::StepBack(MachineState& state)
+{
+	if (frames.size() < 2)
+		return false;
+
+	bool wasKeyframe = frames.back().keyframe;
+
+	// Delta XORed onto newest state gives the one before it
+	if (!wasKeyframe)
+		ApplyXor(frames.back().data, (unsigned char*)&newest);
+
+	bytes -= frames.back().data.size();
+	frames.pop_back();
+
+	// Frame before keyframe is rebuilt from previous keyframe and deltas after it
+	if (wasKeyframe)
+	{
+		size_t keyframe = frames.size() - 1;
+		while (!frames[keyframe].keyframe)
+			--keyframe;
+
+		memset(&newest, 0, sizeof(newest));
+		for (size_t i = keyframe; i < frames.size(); ++i)
+			ApplyXor(frames[i].data, (unsigned char*)&newest);
+
+		sinceKeyframe = (unsigned int)(frames.size() - 1 - keyframe);
+	}
+	else if (sinceKeyframe > 0)
+	{
+		--sinceKeyframe;
+	}
+
+	state = newest;
+	return true;
+}
+
+void RewindBuffer::Clear()
+{
+	frames.clear();
+	bytes = 0;
+	sinceKeyframe = 0;
+}
+
+unsigned int RewindBuffer::Frames() const
+{
+	return (unsigned int)frames.size();
+}
+
+/* Memory used by compressed frames. */
+size_t RewindBuffer::Bytes() const
+{
+	return bytes;
+}
+
+/* Run-length compression tuned for mostly zero data. Output is sequence of
+ * <zero count> <literal count> <literals>, counts are 16-bit little-endian. */
+void RewindBuffer::Compress(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+	out.clear();
+
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t zeros = 0;
+		while (i + zeros < size && data[i + zeros] == 0 && zeros < MAX_RUN)
+			++zeros;
+		i += zeros;
+
+		// Single zero between literals is cheaper to keep as literal than to start new run
+		size_t literals = 0;
+		while (i + literals < size && literals < MAX_RUN &&
+			(data[i + literals] != 0 || (i + literals + 1 < size && data[i + literals + 1] != 0)))
+			++literals;
+
+		out.push_back(zeros & 0xFF);
+		out.push_back(zeros >> 8);
+		out.push_back(literals & 0xFF);
+		out.push_back(literals >> 8);
+		out.insert(out.end(), data + i, data + i + literals);
+		i += literals;
+	}
+}
+
+/* XORs decompressed data onto state. On zeroed state this decompresses keyframe. */
+void RewindBuffer::ApplyXor(const std::vector<unsigned char>& compressed, unsigned char* data)
+{
+	size_t position = 0;
+	for (size_t i = 0; i + 4 <= compressed.size(); )
+	{
+		size_t zeros    = compressed[i] | compressed[i + 1] << 8;
+		size_t literals = compressed[i + 2] | compressed[i + 3] << 8;
+		i += 4;
+
+		position += zeros;
+		for (size_t j = 0; j < literals; ++j)
+			data[position + j] ^= compressed[i + j];
+
+		position += literals;
+		i += literals;
+	}
+}
+
+/* Drops oldest keyframe and deltas which depend on it. Keeps at least one group. */
+void RewindBuffer::DropOldestGroup()
+{
+	size_t next = 1;
+	while (next < frames.size() && !frames[next].keyframe)
+		++next;
+
+	if (next == frames.size())
+		return;
+
+	for (size_t i = 0; i < next; ++i)
+	{
+		bytes -= frames.front().data.size();
+		frames.pop_front();
+	}
+}
\ No newline at end of file
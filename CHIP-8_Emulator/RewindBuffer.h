@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include "Cpu.h"
+
+#define REWIND_SECONDS           120					// history kept by default
+#define REWIND_KEYFRAME_INTERVAL 60						// frames between full states
+#define REWIND_MAX_BYTES         (4 * 1024 * 1024)		// compressed history never grows past this
+
+/* History of machine states, one per emulated frame, for stepping back in time. Every
+ * REWIND_KEYFRAME_INTERVAL-th frame is stored whole, frames in between only as XOR with
+ * previous frame. Both are run-length compressed, XOR of two consecutive frames is almost
+ * all zeros. When history is full, oldest keyframe is dropped with deltas that follow it. */
+class RewindBuffer
+{
+public:
+	explicit RewindBuffer(unsigned int maxFrames = REWIND_SECONDS * TIMER_FREQUENCY, size_t maxBytes = REWIND_MAX_BYTES);
+
+	void Push(const MachineState& state);
+	bool StepBack(MachineState& state);
+	void Clear();
+
+	unsigned int Frames() const;
+	size_t Bytes() const;
+
+private:
+	struct Frame
+	{
+		bool keyframe;
+		std::vector<unsigned char> data;				// compressed state or XOR with previous frame
+	};
+
+	static void Compress(const unsigned char* data, size_t size, std::vector<unsigned char>& out);
+	static void ApplyXor(const std::vector<unsigned char>& compressed, unsigned char* data);
+	void DropOldestGroup();
+
+	std::deque<Frame> frames;							// oldest first, always starts with keyframe
+	MachineState newest;								// state of frames.back()
+	unsigned int maxFrames;
+	size_t maxBytes;
+	size_t bytes;										// compressed size of all frames
+	unsigned int sinceKeyframe;							// frames pushed since last keyframe
+};
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+
+/* Lock-free ring buffer for exactly one producer thread and one consumer thread.
+ * CAPACITY has to be power of two. */
+template <typename T, unsigned int CAPACITY>
+class SpscRing
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SpscRing capacity has to be power of two");
+
+public:
+	SpscRing() : head(0), tail(0) {}
+
+	/* Called only by producer. Returns false if ring is full. */
+	bool Push(const T& item)
+	{
+		unsigned int currentHead = head.load(std::memory_order_relaxed);
+		if (currentHead - tail.load(std::memory_order_acquire) == CAPACITY)
+			return false;
+
+		items[currentHead & (CAPACITY - 1)] = item;
+		head.store(currentHead + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Called only by consumer. Returns false if ring is empty. */
+	bool Pop(T& item)
+	{
+		unsigned int currentTail = tail.load(std::memory_order_relaxed);
+		if (currentTail == head.load(std::memory_order_acquire))
+			return false;
+
+		item = items[currentTail & (CAPACITY - 1)];
+		tail.store(currentTail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Can be called by either side, result may be stale by the time it's used. */
+	bool Empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	T items[CAPACITY];
+	std::atomic<unsigned int> head;						// next slot to write, owned by producer
+	char padding[64];									// keeps head and tail on separate cache lines
+	std::atomic<unsigned int> tail;						// next slot to read, owned by consumer
+};
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "Tracer.h"
+#include "Log.h"
+#include <chrono>
+#include <vector>
+
+#define TRACE_WRITE_BATCH 4096
+
+Tracer::Tracer() : ring(new SpscRing<TraceRecord, TRACE_RING_CAPACITY>()), running(false)
+{
+}
+
+Tracer::~Tracer()
+{
+	Stop();
+}
+
+/* Opens trace file and starts writer thread. */
+bool Tracer::Start(const std::string& tracePath)
+{
+	traceFile.open(tracePath, std::ios_base::binary);
+	if (!traceFile)
+	{
+		LOG_ERROR("Error (trace): Can't open " + tracePath);
+		return false;
+	}
+
+	TraceFileHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord) };
+	traceFile.write((const char*)&header, sizeof(header));
+
+	running = true;
+	writer = std::thread(&Tracer::WriterLoop, this);
+	LOG_INFO("Tracing to " + tracePath);
+	return true;
+}
+
+/* Writes out all records which are still in ring and closes trace file. */
+void Tracer::Stop()
+{
+	if (!running)
+		return;
+
+	running = false;
+	writer.join();
+	traceFile.close();
+}
+
+/* Called by emulation thread for every instruction. Waits only if writer fell behind
+ * and the ring is full, records are never dropped. */
+void Tracer::Record(const TraceRecord& record)
+{
+	while (!ring->Push(record))
+		std::this_thread::yield();
+}
+
+/* Writer thread, drains ring to file in batches. */
+void Tracer::WriterLoop()
+{
+	std::vector<TraceRecord> batch;
+	batch.reserve(TRACE_WRITE_BATCH);
+
+	while (true)
+	{
+		// Read flag before draining, so records pushed before Stop() are written
+		bool stopping = !running;
+
+		TraceRecord record;
+		while (batch.size() < TRACE_WRITE_BATCH && ring->Pop(record))
+			batch.push_back(record);
+
+		if (!batch.empty())
+		{
+			traceFile.write((const char*)batch.data(), batch.size() * sizeof(TraceRecord));
+			batch.clear();
+			continue;
+		}
+
+		if (stopping)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include "SpscRing.h"
+
+#define TRACE_MAGIC         0x52543843					// "C8TR"
+#define TRACE_VERSION       1
+#define TRACE_RING_CAPACITY 65536
+
+// State of machine right before instruction at pc is executed
+struct TraceRecord
+{
+	unsigned long long cycle;
+	unsigned int vDigest;								// Chip8::HashBytes of V registers
+	unsigned short pc;
+	unsigned short opcode;
+	unsigned short I;
+	unsigned char sp;
+	unsigned char delayTimer;
+	unsigned int reserved;
+};
+
+// Written once at the start of trace file, followed by TraceRecords
+struct TraceFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int recordSize;
+};
+
+/* Records executed instructions to binary file. Emulation thread only pushes fixed-size records
+ * to lock-free ring, background thread writes them out. See CHIP-8_TraceDecoder for reading. */
+class Tracer
+{
+public:
+	Tracer();
+	~Tracer();
+
+	bool Start(const std::string& tracePath);
+	void Stop();
+	void Record(const TraceRecord& record);
+
+private:
+	void WriterLoop();
+
+	std::unique_ptr<SpscRing<TraceRecord, TRACE_RING_CAPACITY>> ring;
+	std::ofstream traceFile;
+	std::thread writer;
+	std::atomic<bool> running;
+};
\ No newline at end of file
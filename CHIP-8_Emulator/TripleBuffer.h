@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+
+/* Lock-free triple buffer for exactly one producer thread and one consumer thread. Producer
+ * always has a buffer to write to and consumer always reads the latest published one,
+ * neither side ever waits for the other. Frames published before consumer got to them are
+ * dropped. */
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : back(0), middle(1), front(2) {}
+
+	/* Called only by producer. Buffer to fill before Publish. */
+	T& WriteBuffer()
+	{
+		return buffers[back];
+	}
+
+	/* Called only by producer. Hands written buffer over to consumer. */
+	void Publish()
+	{
+		back = middle.exchange(back | NEW_FRAME, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	/* Called only by consumer. Takes the latest published buffer, returns false if nothing
+	 * was published since last call and ReadBuffer didn't change. */
+	bool Update()
+	{
+		if ((middle.load(std::memory_order_relaxed) & NEW_FRAME) == 0)
+			return false;
+
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	/* Called only by consumer. */
+	const T& ReadBuffer() const
+	{
+		return buffers[front];
+	}
+
+private:
+	static const unsigned int INDEX_MASK = 3;
+	static const unsigned int NEW_FRAME  = 4;			// set in middle while it holds unread buffer
+
+	T buffers[3];
+	unsigned int back;									// owned by producer
+	char padding1[64];									// keeps indices on separate cache lines
+	std::atomic<unsigned int> middle;					// buffer being passed between threads
+	char padding2[64];
+	unsigned int front;									// owned by consumer
+};
\ No newline at end of file
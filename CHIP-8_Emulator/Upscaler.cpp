@@ -0,0 +1,240 @@
+#include "Upscaler.h"
+#include "Cpu.h"
+#include <cstring>
+
+/* Halves red, green and blue, alpha stays opaque. */
+static uint32_t DimColor(uint32_t color)
+{
+	unsigned char bytes[4];
+	memcpy(bytes, &color, sizeof(bytes));
+
+	for (int i = 0; i < 3; ++i)
+		bytes[i] >>= 1;
+
+	memcpy(&color, bytes, sizeof(color));
+	return color;
+}
+
+/* Moves bit i of value to bit 2i. */
+static uint64_t SpreadBits(uint32_t value)
+{
+	uint64_t x = value;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+	x = (x | (x << 8))  & 0x00FF00FF00FF00FFull;
+	x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | (x << 2))  & 0x3333333333333333ull;
+	x = (x | (x << 1))  & 0x5555555555555555ull;
+	return x;
+}
+
+/* 128 pixel row, pixel x of left goes to 2x and pixel x of right to 2x + 1. */
+static void InterleaveRows(uint64_t left, uint64_t right, uint64_t* out)
+{
+	out[0] = (SpreadBits((uint32_t)(left >> 32)) << 1) | SpreadBits((uint32_t)(right >> 32));
+	out[1] = (SpreadBits((uint32_t)left) << 1) | SpreadBits((uint32_t)right);
+}
+
+/* Bits of ifSet where mask is set, bits of otherwise elsewhere. */
+static uint64_t Select(uint64_t mask, uint64_t ifSet, uint64_t otherwise)
+{
+	return (mask & ifSet) | (~mask & otherwise);
+}
+
+ScaleOptions DefaultScaleOptions()
+{
+	ScaleOptions defaults;
+	defaults.factor = DEFAULT_SCALE;
+	defaults.filter = SCALE_NEAREST;
+	defaults.scanlines = false;
+	return defaults;
+}
+
+Upscaler::Upscaler(const ScaleOptions& options)
+{
+	SetOptions(options);
+}
+
+/* Scale factor has to fit limits, EPX doubles first so it needs even one. */
+bool Upscaler::ValidOptions(const ScaleOptions& options)
+{
+	if (options.factor < 1 || options.factor > MAX_SCALE_FACTOR)
+		return false;
+
+	return options.filter != SCALE_EPX || options.factor % 2 == 0;
+}
+
+/* Changes output size and filter. Image is black until next Scale. */
+void Upscaler::SetOptions(const ScaleOptions& newOptions)
+{
+	options = newOptions;
+	lines.assign(2 * options.factor, 0);
+	pixels.assign((size_t)Width() * Height() * 4, 0);
+
+	// Byte of 8 pixels becomes 8 * stretchFactor bits, stored from the top of entryWords words
+	stretchFactor = (options.filter == SCALE_EPX) ? options.factor / 2 : options.factor;
+	unsigned int entryWords = (8 * stretchFactor + 63) / 64;
+	stretchTable.assign(256 * entryWords, 0);
+
+	for (unsigned int value = 0; value < 256; ++value)
+	{
+		uint64_t* entry = &stretchTable[value * entryWords];
+
+		for (unsigned int bit = 0; bit < 8; ++bit)
+		{
+			if ((value & (0x80 >> bit)) == 0)
+				continue;
+
+			for (unsigned int i = bit * stretchFactor; i < (bit + 1) * stretchFactor; ++i)
+				entry[i / 64] |= PIXEL_MASK >> (i % 64);
+		}
+	}
+}
+
+const ScaleOptions& Upscaler::Options() const
+{
+	return options;
+}
+
+/* Rescales screen rows marked in rows (bit y is row y). Returns rows whose output was
+ * redrawn, with EPX it also includes neighbours of marked rows. */
+uint32_t Upscaler::Scale(const uint64_t* gfx, uint32_t rows, const Palette& palette)
+{
+	// EPX output of a row depends on rows above and below it
+	if (options.filter == SCALE_EPX)
+		rows |= (rows << 1) | (rows >> 1);
+
+	Palette dimmed;
+	dimmed.foreground = DimColor(palette.foreground);
+	dimmed.background = DimColor(palette.background);
+
+	for (int y = 0; y < SCREEN_HEIGHT; ++y)
+		if ((rows & (1u << y)) != 0)
+			ScaleRow(gfx, y, palette, dimmed);
+
+	return rows;
+}
+
+/* Fills factor output rows of screen row y. Scaled one bit rows are built first, every
+ * distinct output row is then converted to RGBA once and copied to rows equal to it. */
+void Upscaler::ScaleRow(const uint64_t* gfx, int y, const Palette& palette, const Palette& dimmed)
+{
+	unsigned int factor = options.factor;
+	uint64_t* top = &lines[0];
+	uint64_t* bottom = &lines[factor];
+	unsigned int topRows;								// output rows taken from top line, the rest from bottom
+
+	if (options.filter == SCALE_EPX)
+	{
+		// Scale2x on whole row at once. Neighbours past the screen edge repeat edge pixels.
+		uint64_t p = gfx[y];
+		uint64_t a = (y > 0) ? gfx[y - 1] : p;						// above
+		uint64_t d = (y < SCREEN_HEIGHT - 1) ? gfx[y + 1] : p;		// below
+		uint64_t c = (p >> 1) | (p & PIXEL_MASK);					// left
+		uint64_t b = (p << 1) | (p & 1);							// right
+
+		uint64_t e0 = Select(~(c ^ a) & (c ^ d) & (a ^ b), a, p);
+		uint64_t e1 = Select(~(a ^ b) & (a ^ c) & (b ^ d), b, p);
+		uint64_t e2 = Select(~(d ^ c) & (d ^ b) & (c ^ a), c, p);
+		uint64_t e3 = Select(~(b ^ d) & (b ^ a) & (d ^ c), d, p);
+
+		uint64_t doubled[2];
+		InterleaveRows(e0, e1, doubled);
+		StretchBits(doubled, 2, top);
+		InterleaveRows(e2, e3, doubled);
+		StretchBits(doubled, 2, bottom);
+		topRows = factor / 2;
+	}
+	else
+	{
+		StretchBits(&gfx[y], 1, top);
+		topRows = factor;
+	}
+
+	size_t rowBytes = (size_t)Width() * 4;
+	int converted[2][2] = { { -1, -1 }, { -1, -1 } };	// output row already holding [bottom][dimmed] line
+
+	for (unsigned int i = 0; i < factor; ++i)
+	{
+		unsigned int outY = y * factor + i;
+		int half = (i >= topRows) ? 1 : 0;
+		int dim = (options.scanlines && (outY & 1) != 0) ? 1 : 0;
+		unsigned char* out = &pixels[outY * rowBytes];
+
+		if (converted[half][dim] >= 0)
+		{
+			memcpy(out, &pixels[converted[half][dim] * rowBytes], rowBytes);
+		}
+		else
+		{
+			ConvertRows(half ? bottom : top, factor, dim ? dimmed : palette, out);
+			converted[half][dim] = outY;
+		}
+	}
+}
+
+/* Repeats every bit of wordCount packed words stretchFactor times, out gets wordCount *
+ * stretchFactor words. Works byte by byte, table entry of every byte is appended a whole word
+ * at a time, so cost doesn't grow with number of pixel edges. */
+void Upscaler::StretchBits(const uint64_t* bits, unsigned int wordCount, uint64_t* out) const
+{
+	if (stretchFactor == 1)
+	{
+		memcpy(out, bits, wordCount * sizeof(uint64_t));
+		return;
+	}
+
+	unsigned int entryBits = 8 * stretchFactor;
+	unsigned int entryWords = (entryBits + 63) / 64;
+	uint64_t word = 0;
+	unsigned int used = 0;								// bits of word filled from the top
+
+	for (unsigned int w = 0; w < wordCount; ++w)
+	{
+		for (int shift = 56; shift >= 0; shift -= 8)
+		{
+			const uint64_t* entry = &stretchTable[((bits[w] >> shift) & 0xFF) * entryWords];
+
+			for (unsigned int left = entryBits; left > 0; ++entry)
+			{
+				unsigned int count = (left < 64) ? left : 64;
+				word |= *entry >> used;
+
+				if (used + count < 64)
+				{
+					used += count;
+				}
+				else
+				{
+					// Bits which didn't fit start next word, unused low bits of entry are zero
+					*out++ = word;
+					word = (used == 0) ? 0 : *entry << (64 - used);
+					used = used + count - 64;
+				}
+
+				left -= count;
+			}
+		}
+	}
+}
+
+unsigned int Upscaler::Width() const
+{
+	return SCREEN_WIDTH * options.factor;
+}
+
+unsigned int Upscaler::Height() const
+{
+	return SCREEN_HEIGHT * options.factor;
+}
+
+/* RGBA pixels, rows top to bottom without padding. */
+const unsigned char* Upscaler::Pixels() const
+{
+	return pixels.data();
+}
+
+/* First pixel of output row y. */
+const unsigned char* Upscaler::Row(unsigned int y) const
+{
+	return &pixels[(size_t)y * Width() * 4];
+}
\ No newline at end of file
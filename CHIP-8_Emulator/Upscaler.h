@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "PixelConverter.h"
+
+#define DEFAULT_SCALE    10								// output pixels per screen pixel unless --scale says otherwise
+#define MAX_SCALE_FACTOR 32
+
+enum ScaleFilter
+{
+	SCALE_NEAREST,										// every screen pixel becomes factor x factor block
+	SCALE_EPX											// Scale2x (EPX) rounds diagonal edges, then nearest by factor / 2
+};
+
+struct ScaleOptions
+{
+	unsigned int factor;								// output pixels per screen pixel in both directions
+	ScaleFilter filter;
+	bool scanlines;										// every other output row at half brightness
+};
+
+/* Turns screen to RGBA image factor times bigger. Scaling works on packed rows with one bit
+ * per pixel, 64 pixels per operation, the result is expanded to RGBA by ConvertRows. Window,
+ * screenshots and video export all take pixels from here, so they always match. */
+class Upscaler
+{
+public:
+	explicit Upscaler(const ScaleOptions& options);
+
+	void SetOptions(const ScaleOptions& newOptions);
+	const ScaleOptions& Options() const;
+	uint32_t Scale(const uint64_t* gfx, uint32_t rows, const Palette& palette);
+
+	unsigned int Width() const;
+	unsigned int Height() const;
+	const unsigned char* Pixels() const;
+	const unsigned char* Row(unsigned int y) const;
+
+	static bool ValidOptions(const ScaleOptions& options);
+
+private:
+	void ScaleRow(const uint64_t* gfx, int y, const Palette& palette, const Palette& dimmed);
+	void StretchBits(const uint64_t* bits, unsigned int wordCount, uint64_t* out) const;
+
+	ScaleOptions options;
+	unsigned int stretchFactor;							// times StretchBits repeats every bit, factor / 2 with EPX
+	std::vector<uint64_t> stretchTable;					// every byte value stretched, entries of whole words
+	std::vector<uint64_t> lines;						// scaled one bit rows of one screen row: top and bottom half
+	std::vector<unsigned char> pixels;					// RGBA, Width() x Height()
+};
+
+ScaleOptions DefaultScaleOptions();
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include "VideoCapture.h"
+#include "Log.h"
+#include <chrono>
+#include <cstring>
+
+#define CAPTURE_IDLE_SLEEP std::chrono::milliseconds(5)	// encoder sleeps this long when queue is empty
+
+static void WriteVarint(std::vector<unsigned char>& out, unsigned int value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+
+	out.push_back((unsigned char)value);
+}
+
+static bool ReadVarint(std::istream& in, unsigned int& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 32; shift += 7)
+	{
+		int byte = in.get();
+		if (byte == EOF)
+			return false;
+
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+VideoCapture::VideoCapture()
+{
+	running = false;
+	framesWritten = 0;
+	framesDropped = 0;
+}
+
+VideoCapture::~VideoCapture()
+{
+	Stop();
+}
+
+/* Creates capture file and starts encoder thread. */
+bool VideoCapture::Start(const std::string& capturePath)
+{
+	path = capturePath;
+	file.open(path, std::ios_base::binary);
+	if (!file)
+	{
+		LOG_ERROR("Error (capture): Can't open " + path);
+		return false;
+	}
+
+	VideoFileHeader header;
+	header.magic     = VIDEO_MAGIC;
+	header.version   = VIDEO_VERSION;
+	header.width     = SCREEN_WIDTH;
+	header.height    = SCREEN_HEIGHT;
+	header.frameRate = TIMER_FREQUENCY;
+	file.write((const char*)&header, sizeof(header));
+
+	framesWritten = 0;
+	framesDropped = 0;
+	running.store(true, std::memory_order_release);
+	encoder = std::thread(&VideoCapture::EncoderLoop, this);
+
+	LOG_INFO("Capturing video to " + path);
+	return true;
+}
+
+/* Waits until encoder writes every queued frame and closes capture file. */
+void VideoCapture::Stop()
+{
+	if (!encoder.joinable())
+		return;
+
+	running.store(false, std::memory_order_release);
+	encoder.join();
+	file.close();
+
+	if (!file)
+	{
+		LOG_ERROR("Error (capture): Can't write " + path);
+		return;
+	}
+
+	if (framesDropped > 0)
+		LOG_WARNING("Warning (capture): " + std::to_string(framesDropped) + " frames dropped, encoder couldn't keep up.");
+
+	LOG_INFO("Video saved to " + path + ", " + std::to_string(framesWritten) + " frames");
+}
+
+/* Queues copy of screen for encoder. Called only by one thread, the one which emulates. When
+ * queue is full, frame is dropped and false returned, unless waitIfFull is set. */
+bool VideoCapture::AddFrame(const uint64_t* gfx, bool waitIfFull)
+{
+	ScreenFrame frame;
+	memcpy(frame.gfx, gfx, sizeof(frame.gfx));
+
+	while (!queue.Push(frame))
+	{
+		if (!waitIfFull)
+		{
+			++framesDropped;
+			return false;
+		}
+
+		std::this_thread::yield();
+	}
+
+	return true;
+}
+
+/* Runs on encoder thread until Stop. */
+void VideoCapture::EncoderLoop()
+{
+	ScreenFrame previous;
+	memset(previous.gfx, 0, sizeof(previous.gfx));
+
+	ScreenFrame frame;
+	std::vector<unsigned char> encoded;
+
+	for (;;)
+	{
+		// Checked before draining, frames queued before Stop are always written
+		bool stopping = !running.load(std::memory_order_acquire);
+
+		while (queue.Pop(frame))
+		{
+			encoded.clear();
+			EncodeFrame(frame, previous, encoded);
+			file.write((const char*)encoded.data(), encoded.size());
+
+			previous = frame;
+			++framesWritten;
+		}
+
+		if (stopping)
+			break;
+
+		std::this_thread::sleep_for(CAPTURE_IDLE_SLEEP);
+	}
+}
+
+/* Appends frame as lengths of alternating runs of pixels which are the same as in previous
+ * frame and pixels which changed. Runs go row by row, leftmost pixel first. */
+void VideoCapture::EncodeFrame(const ScreenFrame& frame, const ScreenFrame& previous, std::vector<unsigned char>& out)
+{
+	unsigned int run = 0;
+	uint64_t runBits = 0;								// all ones while counting changed pixels
+
+	for (int y = 0; y < SCREEN_HEIGHT; ++y)
+	{
+		uint64_t changed = frame.gfx[y] ^ previous.gfx[y];
+
+		// Whole row continues current run
+		if (changed == runBits)
+		{
+			run += SCREEN_WIDTH;
+			continue;
+		}
+
+		for (int x = 0; x < SCREEN_WIDTH; ++x)
+		{
+			if (((changed << x) & PIXEL_MASK) != (runBits & PIXEL_MASK))
+			{
+				WriteVarint(out, run);
+				run = 0;
+				runBits = ~runBits;
+			}
+
+			++run;
+		}
+	}
+
+	WriteVarint(out, run);
+}
+
+/* Reads one frame written by EncodeFrame and applies it to frame, which holds previous frame.
+ * changedRows gets bit y set for every row which changed. Returns false if data ends early. */
+bool VideoCapture::DecodeFrame(std::istream& in, ScreenFrame& frame, uint32_t& changedRows)
+{
+	unsigned int pixel = 0;
+	bool changed = false;
+	changedRows = 0;
+
+	while (pixel < NUM_PIXELS)
+	{
+		unsigned int run;
+		if (!ReadVarint(in, run) || run > NUM_PIXELS - pixel)
+			return false;
+
+		for (unsigned int i = pixel; changed && i < pixel + run; ++i)
+		{
+			frame.gfx[i / SCREEN_WIDTH] ^= PIXEL_MASK >> (i % SCREEN_WIDTH);
+			changedRows |= 1u << (i / SCREEN_WIDTH);
+		}
+
+		pixel += run;
+		changed = !changed;
+	}
+
+	return true;
+}
+
+/* Converts RGBA pixels to planar YUV 4:4:4 with BT.601 studio range, as most players expect. */
+static void ConvertToYUV(const unsigned char* rgba, unsigned int pixelCount, unsigned char* planes)
+{
+	unsigned char* yPlane = planes;
+	unsigned char* uPlane = planes + pixelCount;
+	unsigned char* vPlane = planes + pixelCount * 2;
+
+	for (unsigned int i = 0; i < pixelCount; ++i, rgba += 4)
+	{
+		int r = rgba[0];
+		int g = rgba[1];
+		int b = rgba[2];
+
+		yPlane[i] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		uPlane[i] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		vPlane[i] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+}
+
+/* Scales every frame of capture with the same Upscaler as window uses and writes it as Y4M
+ * (if outputPath ends with .y4m) or as raw RGBA frames back to back. */
+bool ExportVideo(const std::string& capturePath, const std::string& outputPath, const ScaleOptions& scaleOptions, const Palette& palette)
+{
+	std::ifstream captureFile(capturePath, std::ios_base::binary);
+	if (!captureFile)
+	{
+		LOG_ERROR("Error exporting video: Can't open " + capturePath);
+		return false;
+	}
+
+	VideoFileHeader header;
+	if (!captureFile.read((char*)&header, sizeof(header)) || header.magic != VIDEO_MAGIC)
+	{
+		LOG_ERROR("Error exporting video: " + capturePath + " is not a capture file");
+		return false;
+	}
+
+	if (header.version != VIDEO_VERSION || header.width != SCREEN_WIDTH || header.height != SCREEN_HEIGHT)
+	{
+		LOG_ERROR("Error exporting video: " + capturePath + " was captured by incompatible version");
+		return false;
+	}
+
+	std::ofstream outputFile(outputPath, std::ios_base::binary);
+	if (!outputFile)
+	{
+		LOG_ERROR("Error exporting video: Can't open " + outputPath);
+		return false;
+	}
+
+	Upscaler upscaler(scaleOptions);
+	unsigned int pixelCount = upscaler.Width() * upscaler.Height();
+
+	bool y4m = outputPath.size() >= 4 && outputPath.compare(outputPath.size() - 4, 4, ".y4m") == 0;
+	if (y4m)
+	{
+		outputFile << "YUV4MPEG2 W" << upscaler.Width() << " H" << upscaler.Height()
+			<< " F" << header.frameRate << ":1 Ip A1:1 C444\n";
+	}
+
+	std::vector<unsigned char> planes(y4m ? pixelCount * 3 : 0);
+	ScreenFrame frame;
+	memset(frame.gfx, 0, sizeof(frame.gfx));
+	unsigned int frames = 0;
+
+	while (captureFile.peek() != EOF)
+	{
+		uint32_t changedRows;
+		if (!VideoCapture::DecodeFrame(captureFile, frame, changedRows))
+		{
+			LOG_ERROR("Error exporting video: " + capturePath + " is truncated");
+			return false;
+		}
+
+		// Upscaler starts black, not in palette colors
+		upscaler.Scale(frame.gfx, (frames == 0) ? ALL_ROWS : changedRows, palette);
+
+		if (y4m)
+		{
+			ConvertToYUV(upscaler.Pixels(), pixelCount, planes.data());
+			outputFile << "FRAME\n";
+			outputFile.write((const char*)planes.data(), planes.size());
+		}
+		else
+		{
+			outputFile.write((const char*)upscaler.Pixels(), (std::streamsize)pixelCount * 4);
+		}
+
+		++frames;
+	}
+
+	if (!outputFile)
+	{
+		LOG_ERROR("Error exporting video: Can't write " + outputPath);
+		return false;
+	}
+
+	LOG_INFO("Exported " + std::to_string(frames) + " frames of " + std::to_string(upscaler.Width()) + "x"
+		+ std::to_string(upscaler.Height()) + " to " + outputPath);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Cpu.h"
+#include "SpscRing.h"
+#include "Upscaler.h"
+
+#define CAPTURE_QUEUE_SIZE 256							// frames waiting for encoder, about 4 seconds
+#define VIDEO_MAGIC   0x44563843						// "C8VD"
+#define VIDEO_VERSION 1
+
+// Written at the start of capture file, followed by frames
+struct VideoFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int frameRate;								// frames per second of emulated time
+};
+
+/* Records screen once per 60 Hz frame to capture file. AddFrame only copies screen to lock-free
+ * queue, encoder thread compresses and writes it, so emulation never waits for disk. Every frame
+ * is stored as XOR with previous one, one bit per pixel, as lengths of alternating runs of
+ * unchanged and changed pixels (LEB128 varints, first run is unchanged). Unchanged frame takes
+ * 2 bytes. ExportVideo turns capture to Y4M or raw RGBA. */
+class VideoCapture
+{
+public:
+	VideoCapture();
+	~VideoCapture();
+
+	bool Start(const std::string& path);
+	void Stop();
+	bool AddFrame(const uint64_t* gfx, bool waitIfFull);
+
+	static void EncodeFrame(const ScreenFrame& frame, const ScreenFrame& previous, std::vector<unsigned char>& out);
+	static bool DecodeFrame(std::istream& in, ScreenFrame& frame, uint32_t& changedRows);
+
+private:
+	void EncoderLoop();
+
+	std::string path;
+	std::ofstream file;
+	std::thread encoder;
+	std::atomic<bool> running;
+	SpscRing<ScreenFrame, CAPTURE_QUEUE_SIZE> queue;
+	unsigned int framesWritten;							// owned by encoder thread until Stop
+	unsigned int framesDropped;							// owned by producer, frames which didn't fit in queue
+};
+
+bool ExportVideo(const std::string& capturePath, const std::string& outputPath, const ScaleOptions& scaleOptions, const Palette& palette);
\ No newline at end of file
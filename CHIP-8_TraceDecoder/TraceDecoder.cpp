@@ -0,0 +1,39 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "Disassembler.h"
+#include "Tracer.h"
+
+/* Turns binary trace written by CHIP-8_Emulator --trace into readable disassembly, one line per instruction. */
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		std::cout << "Usage: CHIP-8_TraceDecoder <trace file>" << std::endl;
+		return 1;
+	}
+
+	std::ifstream traceFile(argv[1], std::ios_base::binary);
+
+	TraceFileHeader header;
+	if (!traceFile.read((char*)&header, sizeof(header)) || header.magic != TRACE_MAGIC)
+	{
+		std::cout << "Error: " << argv[1] << " is not a Chip8 trace file." << std::endl;
+		return 1;
+	}
+
+	if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord))
+	{
+		std::cout << "Error: Unsupported trace version " << header.version << "." << std::endl;
+		return 1;
+	}
+
+	TraceRecord record;
+	while (traceFile.read((char*)&record, sizeof(record)))
+	{
+		printf("%10llu  %03X  %04X  %-16s I=%03X SP=%X DT=%02X V#=%08X\n", record.cycle, record.pc, record.opcode,
+			Disassemble(record.opcode).c_str(), record.I, record.sp, record.delayTimer, record.vDigest);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,345 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Must match values in CHIP-8_Emulator/Cpu.h
+#define MEMORY_SIZE      4096
+#define ROM_START        0x200
+#define MAX_BLOCK_LENGTH 32
+
+/* Translates Chip8 ROM ahead of time to C++ translation unit which is compiled into
+ * CHIP-8_Emulator (see README). Every basic block reachable from 0x200 becomes one function
+ * operating directly on Chip8 state. Computed jumps (BNNN), returns and code which is
+ * modified at runtime are left to the interpreter. */
+
+struct Block
+{
+	unsigned short start;
+	std::vector<unsigned short> opcodes;
+};
+
+static unsigned char memory[MEMORY_SIZE];
+static unsigned int romSize = 0;
+
+/* FNV-1a hash, same as Chip8::HashBytes. */
+static unsigned int HashBytes(const unsigned char* data, unsigned int size)
+{
+	unsigned int hash = 2166136261u;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static std::string Hex(unsigned int value, int digits)
+{
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "0x%0*X", digits, value);
+	return buffer;
+}
+
+static bool InsideROM(unsigned int address)
+{
+	return address >= ROM_START && address + 1 < ROM_START + romSize;
+}
+
+/* True for opcodes which Chip8::Decode turns to OpUnknown. */
+static bool IsUnknown(unsigned short opcode)
+{
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+		return (opcode & 0x000F) != 0x0000 && (opcode & 0x000F) != 0x000E;
+
+	case 0x8000:
+		return (opcode & 0x000F) > 0x0007 && (opcode & 0x000F) != 0x000E;
+
+	case 0xE000:
+		return (opcode & 0x000F) != 0x000E && (opcode & 0x000F) != 0x0001;
+
+	case 0xF000:
+		switch (opcode & 0x00FF)
+		{
+		case 0x0007:
+		case 0x000A:
+		case 0x0015:
+		case 0x0018:
+		case 0x001E:
+		case 0x0029:
+		case 0x0033:
+		case 0x0055:
+		case 0x0065: return false;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/* Same set of instructions as Chip8::EndsBlock. Unknown opcode doesn't advance pc, so
+ * interpreter stays on it and block must not go past it either. */
+static bool EndsBlock(unsigned short opcode)
+{
+	if (IsUnknown(opcode))
+		return true;
+
+	switch (opcode & 0xF000)
+	{
+	case 0x0000: return (opcode & 0x000F) == 0x000E; // 00EE
+	case 0x1000:
+	case 0x2000:
+	case 0x3000:
+	case 0x4000:
+	case 0x5000:
+	case 0x9000:
+	case 0xB000:
+	case 0xE000: return true;
+	case 0xF000:
+		switch (opcode & 0x00FF)
+		{
+		case 0x000A:
+		case 0x0033:
+		case 0x0055: return true;
+		}
+		break;
+	}
+
+	return false;
+}
+
+/* Decodes block starting at address and adds addresses where execution can continue after it. */
+static Block ReadBlock(unsigned short start, std::vector<unsigned short>& successors)
+{
+	Block block;
+	block.start = start;
+
+	unsigned short address = start;
+	while (InsideROM(address) && block.opcodes.size() < MAX_BLOCK_LENGTH)
+	{
+		unsigned short opcode = memory[address] << 8 | memory[address + 1];
+		block.opcodes.push_back(opcode);
+
+		if (!EndsBlock(opcode))
+		{
+			address += 2;
+			continue;
+		}
+
+		// Execution never gets past unknown opcode
+		if (IsUnknown(opcode))
+			return block;
+
+		switch (opcode & 0xF000)
+		{
+		case 0x1000:
+			successors.push_back(opcode & 0x0FFF);
+			break;
+
+		case 0x2000: // Subroutine and the instruction after the call, where 00EE returns
+			successors.push_back(opcode & 0x0FFF);
+			successors.push_back(address + 2);
+			break;
+
+		case 0x3000:
+		case 0x4000:
+		case 0x5000:
+		case 0x9000:
+		case 0xE000:
+			successors.push_back(address + 2);
+			successors.push_back(address + 4);
+			break;
+
+		case 0xF000: // FX0A, FX33, FX55
+			successors.push_back(address + 2);
+			break;
+		}
+
+		return block;
+	}
+
+	// Block was cut because of length, continue where it stopped
+	successors.push_back(address);
+	return block;
+}
+
+/* Recursive-descent walk over control flow graph starting at 0x200. */
+static std::map<unsigned short, Block> FindBlocks()
+{
+	std::map<unsigned short, Block> blocks;
+	std::vector<unsigned short> worklist(1, ROM_START);
+
+	while (!worklist.empty())
+	{
+		unsigned short address = worklist.back();
+		worklist.pop_back();
+
+		if (!InsideROM(address) || blocks.count(address) != 0)
+			continue;
+
+		std::vector<unsigned short> successors;
+		Block block = ReadBlock(address, successors);
+		if (block.opcodes.empty())
+			continue;
+
+		blocks[address] = block;
+		worklist.insert(worklist.end(), successors.begin(), successors.end());
+	}
+
+	return blocks;
+}
+
+/* Call of interpreter handler for instructions which are not worth inlining. */
+static std::string HandlerCall(const char* handler, unsigned short opcode)
+{
+	std::ostringstream code;
+	code << "{ static const Chip8::DecodedInstruction instr = { &Chip8::" << handler << ", " << Hex(opcode, 4) << ", "
+		<< Hex(opcode & 0x0FFF, 3) << ", " << ((opcode & 0x0F00) >> 8) << ", " << ((opcode & 0x00F0) >> 4) << ", "
+		<< (opcode & 0x000F) << ", " << Hex(opcode & 0x00FF, 2) << " }; c." << handler << "(instr); }";
+	return code.str();
+}
+
+/* C++ statements for one instruction. Semantics match handlers in Cpu.cpp. */
+static std::string TranslateInstruction(unsigned short opcode)
+{
+	std::string x   = "c.V[" + Hex((opcode & 0x0F00) >> 8, 1) + "]";
+	std::string y   = "c.V[" + Hex((opcode & 0x00F0) >> 4, 1) + "]";
+	std::string vf  = "c.V[0xF]";
+	std::string nn  = Hex(opcode & 0x00FF, 2);
+	std::string nnn = Hex(opcode & 0x0FFF, 3);
+
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+		if ((opcode & 0x000F) == 0x0000) return HandlerCall("Op00E0", opcode);
+		if ((opcode & 0x000F) == 0x000E) return "--c.sp; c.pc = c.stack[c.sp] + 2;";
+		return HandlerCall("OpUnknown", opcode);
+
+	case 0x1000: return "c.pc = " + nnn + ";";
+	case 0x2000: return "c.stack[c.sp] = c.pc; ++c.sp; c.pc = " + nnn + ";";
+	case 0x3000: return "c.pc += (" + x + " == " + nn + ") ? 4 : 2;";
+	case 0x4000: return "c.pc += (" + x + " != " + nn + ") ? 4 : 2;";
+	case 0x5000: return "c.pc += (" + x + " == " + y + ") ? 4 : 2;";
+	case 0x6000: return x + " = " + nn + "; c.pc += 2;";
+	case 0x7000: return x + " += " + nn + "; c.pc += 2;";
+
+	case 0x8000:
+		switch (opcode & 0x000F)
+		{
+		case 0x0000: return x + " = " + y + "; c.pc += 2;";
+		case 0x0001: return x + " |= " + y + "; c.pc += 2;";
+		case 0x0002: return x + " &= " + y + "; c.pc += 2;";
+		case 0x0003: return x + " ^= " + y + "; c.pc += 2;";
+		case 0x0004: return vf + " = (" + y + " > 0xFF - " + x + ") ? 1 : 0; " + x + " += " + y + "; c.pc += 2;";
+		case 0x0005: return vf + " = (" + x + " < " + y + ") ? 0 : 1; " + x + " -= " + y + "; c.pc += 2;";
+		case 0x0006: return vf + " = " + y + " & 1; " + y + " >>= 1; " + x + " = " + y + "; c.pc += 2;";
+		case 0x0007: return vf + " = (" + x + " > " + y + ") ? 0 : 1; " + x + " = " + y + " - " + x + "; c.pc += 2;";
+		case 0x000E: return vf + " = " + y + " & 1; " + y + " <<= 1; " + x + " = " + y + "; c.pc += 2;";
+		}
+		return HandlerCall("OpUnknown", opcode);
+
+	case 0x9000: return "c.pc += (" + x + " != " + y + ") ? 4 : 2;";
+	case 0xA000: return "c.I = " + nnn + "; c.pc += 2;";
+	case 0xB000: return HandlerCall("OpBNNN", opcode);
+	case 0xC000: return HandlerCall("OpCXNN", opcode);
+	case 0xD000: return HandlerCall("OpDXYN", opcode);
+
+	case 0xE000:
+		if ((opcode & 0x000F) == 0x000E) return "c.pc += (c.key[" + x + "] != 0) ? 4 : 2;";
+		if ((opcode & 0x000F) == 0x0001) return "c.pc += (c.key[" + x + "] == 0) ? 4 : 2;";
+		return HandlerCall("OpUnknown", opcode);
+
+	case 0xF000:
+		switch (opcode & 0x00FF)
+		{
+		case 0x0007: return x + " = c.delayTimer; c.pc += 2;";
+		case 0x000A: return HandlerCall("OpFX0A", opcode);
+		case 0x0015: return "c.delayTimer = " + x + "; c.pc += 2;";
+		case 0x0018: return "c.soundTimer = " + x + "; c.pc += 2;";
+		case 0x001E: return "c.I += " + x + "; c.pc += 2;";
+		case 0x0029: return "c.I = " + x + " * 5; c.pc += 2;";
+		case 0x0033: return HandlerCall("OpFX33", opcode);
+		case 0x0055: return HandlerCall("OpFX55", opcode);
+		case 0x0065: return HandlerCall("OpFX65", opcode);
+		}
+		return HandlerCall("OpUnknown", opcode);
+	}
+
+	return HandlerCall("OpUnknown", opcode);
+}
+
+static std::string BlockName(unsigned short start)
+{
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "Block_%04X", start);
+	return buffer;
+}
+
+static void WriteTranslation(std::ostream& out, const std::string& romPath, const std::map<unsigned short, Block>& blocks)
+{
+	out << "// Generated by CHIP-8_Translator from " << romPath << ", do not edit.\n"
+		<< "#include \"Cpu.h\"\n\n"
+		<< "struct Chip8Translated\n{\n";
+
+	for (const auto& entry : blocks)
+		out << "\tstatic void " << BlockName(entry.first) << "(Chip8& c);\n";
+
+	out << "};\n";
+
+	for (const auto& entry : blocks)
+	{
+		const Block& block = entry.second;
+		out << "\nvoid Chip8Translated::" << BlockName(block.start) << "(Chip8& c)\n{\n";
+
+		for (size_t i = 0; i < block.opcodes.size(); ++i)
+		{
+			out << "\t/* " << Hex(block.start + i * 2, 3) << ": " << Hex(block.opcodes[i], 4) << " */ "
+				<< TranslateInstruction(block.opcodes[i]) << " c.UpdateTimers();\n";
+		}
+
+		out << "}\n";
+	}
+
+	out << "\nstatic const TranslatedBlock blocks[] =\n{\n";
+	for (const auto& entry : blocks)
+		out << "\t{ " << Hex(entry.first, 3) << ", " << entry.second.opcodes.size() << ", &Chip8Translated::" << BlockName(entry.first) << " },\n";
+
+	out << "};\n\n"
+		<< "extern const TranslatedProgram translatedProgram =\n{\n"
+		<< "\t" << romSize << ", " << Hex(HashBytes(memory + ROM_START, romSize), 8) << "u, blocks, " << blocks.size() << "\n"
+		<< "};\n";
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		std::cout << "Usage: CHIP-8_Translator <ROM path> <output .cpp>" << std::endl;
+		return 1;
+	}
+
+	std::ifstream inputFile(argv[1], std::ios_base::binary);
+	if (!inputFile)
+	{
+		std::cout << "Error: Can't open ROM " << argv[1] << std::endl;
+		return 1;
+	}
+
+	inputFile.read((char*)memory + ROM_START, MEMORY_SIZE - ROM_START);
+	romSize = (unsigned int)inputFile.gcount();
+
+	std::map<unsigned short, Block> blocks = FindBlocks();
+
+	std::ofstream outputFile(argv[2]);
+	WriteTranslation(outputFile, argv[1], blocks);
+
+	std::cout << "Translated " << blocks.size() << " blocks from " << argv[1] << std::endl;
+	return outputFile.good() ? 0 : 1;
+}
\ No newline at end of file